@@ -0,0 +1,99 @@
+#include "precomp.hpp"
+
+#include "Bench.hpp"
+
+#include "Context.hpp"
+#include "FileParser.hpp"
+
+namespace {
+	std::atomic<size_t> allocationCount(0);
+}
+
+// Count every heap allocation made by the benchmark binary
+void* operator new(size_t size)
+{
+	++allocationCount;
+	if (void* p = malloc(size == 0 ? 1 : size))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+size_t Bench::allocationsSoFar()
+{
+	return allocationCount;
+}
+
+bool Bench::allocations(Results& r)
+{
+	static const size_t reps = 1000;
+	// What the common path may allocate per macro: nothing for options and arguments,
+	// and only the occasional growth of the parser's replacement buffers for whole expansions
+	static const size_t optionsBudget = 0;
+	static const double expansionBudget = 0.1;
+
+	bool passed = true;
+	Context ctxt(nullptr);
+
+	// Options and arguments alone should not allocate
+	{
+		static const std::string args = "[inf, lim, name = \"quoted value\"]{f(x)}{x}{a}{b}";
+		const size_t before = allocationCount;
+		for (size_t i = 0; i < reps; ++i) {
+			Parser p("bench", args.data(), args.data() + args.size(), ctxt);
+			p.parseMacroOptions();
+			p.parseBracketArgs();
+		}
+		const size_t allocs = allocationCount - before;
+		const double perMacro = (double)allocs / reps;
+		printf("parseMacroOptions + parseBracketArgs: %.2f allocations/macro\n", perMacro);
+		r.add("parseMacroOptions+parseBracketArgs", "allocations", perMacro, "allocations/macro");
+		if (allocs > optionsBudget) {
+			fprintf(stderr, "FAIL: parseMacroOptions + parseBracketArgs allocated %zu times (at most %zu allowed)\n",
+			        allocs, optionsBudget);
+			passed = false;
+		}
+	}
+
+	// Full expansions, including the replacement itself and its bookkeeping (in display math, where they apply)
+	static const std::array<const char*, 6> macros = {{
+		"\\integral[inf]{f(x)}{x} ",
+		"\\summ[mir]{n}{N} ",
+		"\\deriv{y}{x}{2} ",
+		"\\unit{mV} ",
+		"--> ",
+		"\\begin{piecewise}{f(x)}\n\\piece{1}{x > 0}\n\\piece{0}\n\\end{piecewise}\n"
+	}};
+	for (const char* macro : macros) {
+		std::string input = "\\[\n";
+		for (size_t i = 0; i < reps; ++i)
+			input += macro;
+		input += "\\]\n";
+
+		const size_t before = allocationCount;
+		Parser p("bench", input.data(), input.data() + input.size(), ctxt);
+		p.parseLoop(true);
+		const size_t allocs = allocationCount - before;
+
+		std::string name(macro, strcspn(macro, "[{ "));
+		const double perMacro = (double)allocs / reps;
+		printf("%s: %.2f allocations/macro\n", name.c_str(), perMacro);
+		r.add(name, "allocations", perMacro, "allocations/macro");
+
+		// Nothing being expanded would allocate nothing too, so check that everything was
+		if (p.replacements.size() < reps) {
+			fprintf(stderr, "FAIL: %s was only expanded %zu of %zu times\n", name.c_str(), p.replacements.size(), reps);
+			passed = false;
+		}
+		if (perMacro > expansionBudget) {
+			fprintf(stderr, "FAIL: %s made %.2f allocations/macro (at most %.2f allowed)\n",
+			        name.c_str(), perMacro, expansionBudget);
+			passed = false;
+		}
+	}
+	return passed;
+}
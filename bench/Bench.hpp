@@ -0,0 +1,137 @@
+#ifndef __BENCH_HPP__
+#define __BENCH_HPP__
+
+//! Helpers shared by the SemTeX benchmarks
+namespace Bench {
+
+	/*!
+	 * \brief Collects benchmark results so they can be written out as JSON
+	 *        (see semtex-bench --json), to track regressions between releases
+	 */
+	class Results {
+	public:
+		Results() : results() { }
+
+		/*!
+		 * \brief Records a result
+		 * \param benchmark What was measured (e.g. "parseLoop/prose")
+		 * \param metric What about it was measured (e.g. "throughput")
+		 * \param value The measurement
+		 * \param unit The measurement's units (e.g. "MB/s")
+		 */
+		void add(const std::string& benchmark, const std::string& metric, double value, const std::string& unit)
+		{
+			results.push_back({benchmark, metric, value, unit});
+		}
+
+		//! Writes every result out as a JSON object
+		void writeJson(FILE* out) const;
+
+	private:
+		struct Result {
+			std::string benchmark;
+			std::string metric;
+			double value;
+			std::string unit;
+		};
+
+		std::vector<Result> results;
+	};
+
+	//! The kinds of synthetic input the corpus generator makes
+	enum class CorpusKind {
+		Prose, //!< Paragraphs of text with the occasional bit of math
+		MathDense, //!< Little but macros, in display math
+		Nested, //!< Macros in the arguments of macros, several deep
+		LongLines, //!< Math-dense text with few newlines
+		Crlf, //!< Math-dense text with Windows newlines
+		OptionHeavy, //!< Macros with long options lists, in align* environments
+		Listings //!< Prose between code listings full of things that look like keys (which aren't replaced)
+	};
+
+	//! Every corpus kind, for looping over
+	extern const std::array<CorpusKind, 7> allCorpusKinds;
+
+	//! A synthetic input
+	struct Corpus {
+		std::string text;
+		size_t macros; //!< How many macros there are in text (counting nested ones)
+	};
+
+	//! Returns a short name for a corpus kind (e.g. "math-dense")
+	const char* corpusName(CorpusKind kind);
+
+	/*!
+	 * \brief Generates a synthetic input
+	 * \param kind What sort of input to make
+	 * \param size Roughly how many bytes to make (it stops at the first paragraph break past this)
+	 * \param seed Seeds the generator. The same seed always makes the same input.
+	 */
+	Corpus generateCorpus(CorpusKind kind, size_t size, unsigned int seed = 1);
+
+	/*!
+	 * \brief Runs a function until a minimum amount of time has passed
+	 * \param fn The function to time
+	 * \param minSeconds The minimum total running time
+	 * \returns The mean number of seconds taken by each call to fn
+	 */
+	template <typename F>
+	double secondsPerCall(F&& fn, double minSeconds = 0.5)
+	{
+		using clock = std::chrono::steady_clock;
+
+		fn(); // Warm up caches, etc.
+
+		size_t calls = 0;
+		const auto start = clock::now();
+		std::chrono::duration<double> elapsed(0);
+		do {
+			fn();
+			++calls;
+			elapsed = clock::now() - start;
+		} while (elapsed.count() < minSeconds);
+
+		return elapsed.count() / calls;
+	}
+
+	//! Benchmarks Parser::parseMacroOptions on options-heavy input
+	void macroOptions(Results& r);
+
+	/*!
+	 * \brief Checks that parsing stays linear in the length of a line, timing a 10 MB line with no spaces
+	 *        against half of it
+	 * \returns false (having printed why) if twice the input took well over twice the time
+	 */
+	bool longLines(Results& r);
+
+	//! Returns how many heap allocations the benchmark binary has made so far
+	size_t allocationsSoFar();
+
+	/*!
+	 * \brief Counts heap allocations made while parsing and expanding macros
+	 * \returns false (having printed why) if options and arguments allocated at all,
+	 *          or a common expansion allocated more than its budget (or wasn't made)
+	 */
+	bool allocations(Results& r);
+
+	//! Compares resident memory when a large input is mapped vs. read into the heap
+	void inputMemory(Results& r);
+
+	//! Times processing a project with many included files, with the worker pool and the old polling threads
+	void includePool(Results& r);
+
+	/*!
+	 * \brief Measures throughput (MB/s) and cost per macro (ns/macro) of Parser::parseLoop on each corpus kind,
+	 *        of parseMacroOptions, parseBracketArgs and OutputWriter, and of each Replacer
+	 */
+	void throughput(Results& r);
+
+	/*!
+	 * \brief Reports the allocations made by static initialization,
+	 *        and times SemTeX starting up and shutting down (run on empty input)
+	 * \param allocationsBeforeMain What allocationsSoFar() returned at the start of main
+	 */
+	void startup(Results& r, size_t allocationsBeforeMain);
+}
+
+#endif
@@ -0,0 +1,42 @@
+#include "precomp.hpp"
+
+#include "Bench.hpp"
+
+int main(int argc, char** argv)
+{
+	const size_t allocationsBeforeMain = Bench::allocationsSoFar();
+
+	// semtex-bench [--json FILE] also writes every result to FILE (or stdout, for -) as JSON
+	const char* jsonPath = nullptr;
+	if (argc == 3 && strcmp(argv[1], "--json") == 0) {
+		jsonPath = argv[2];
+	}
+	else if (argc != 1) {
+		fprintf(stderr, "Usage: %s [--json FILE]\n", argv[0]);
+		return 1;
+	}
+
+	// Checks that fail make us exit non-zero (after running everything), so make bench catches regressions
+	bool passed = true;
+	Bench::Results results;
+	Bench::macroOptions(results);
+	passed &= Bench::longLines(results);
+	passed &= Bench::allocations(results);
+	Bench::inputMemory(results);
+	Bench::includePool(results);
+	Bench::throughput(results);
+	Bench::startup(results, allocationsBeforeMain);
+
+	if (jsonPath != nullptr) {
+		const bool toStdout = strcmp(jsonPath, "-") == 0;
+		FILE* out = toStdout ? stdout : fopen(jsonPath, "w");
+		if (out == nullptr) {
+			fprintf(stderr, "Could not write %s\n", jsonPath);
+			return 1;
+		}
+		results.writeJson(out);
+		if (!toStdout)
+			fclose(out);
+	}
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,188 @@
+#include "precomp.hpp"
+
+#include "Bench.hpp"
+
+#include <random>
+
+const std::array<Bench::CorpusKind, 7> Bench::allCorpusKinds = {{
+	CorpusKind::Prose, CorpusKind::MathDense, CorpusKind::Nested,
+	CorpusKind::LongLines, CorpusKind::Crlf, CorpusKind::OptionHeavy, CorpusKind::Listings
+}};
+
+namespace {
+	//! Words for prose. None of them contain anything SemTeX replaces.
+	const std::array<const char*, 16> words = {{
+		"the", "signal", "is", "sampled", "at", "twice", "its", "bandwidth", "so", "that",
+		"no", "aliasing", "occurs", "when", "we", "reconstruct"
+	}};
+
+	//! One of each macro SemTeX expands, as written in math-dense input
+	const std::array<const char*, 6> macros = {{
+		"\\integral[inf]{f(x)}{x}",
+		"\\summ[mir]{n}{N}",
+		"\\deriv{y}{x}{2}",
+		"\\unit{mV}",
+		"x --> y",
+		"\\begin{piecewise}{f(x)}\n\\piece{1}{x > 0}\n\\piece{0}\n\\end{piecewise}"
+	}};
+
+	//! Macros with long flag lists, spread across lines like people write them
+	const std::array<const char*, 2> optionMacros = {{
+		"\\integral[ inf , lim,\n    mir ]{f(x)}{x}",
+		"\\summ[mir,\n    lim ,inf]{n}{N}"
+	}};
+
+	//! Lines of code for listings, full of things that would be keys outside of them
+	const std::array<const char*, 6> codeLines = {{
+		"for (node* n = head; n != nullptr; n = n->next) {",
+		"    if (n->count <= limit && n->count >= 0)",
+		"        total += n->weight; // running sum --> checked below",
+		"    printf(\"%d != %d\\n\", total, expected);",
+		"}",
+		"assert(total == expected || \"w == 0); % not a comment here"
+	}};
+
+	//! The raw environments listings are put in
+	const std::array<const char*, 3> listingEnvironments = {{"lstlisting", "verbatim", "minted"}};
+
+	class Generator {
+	public:
+		Generator(Bench::CorpusKind k, unsigned int seed) : kind(k), rng(seed), out{std::string(), 0}, macroCount(0) { }
+
+		Bench::Corpus generate(size_t size)
+		{
+			while (out.text.size() < size)
+				paragraph();
+			out.macros = macroCount;
+			return std::move(out);
+		}
+
+	private:
+		Bench::CorpusKind kind;
+		std::mt19937 rng;
+		Bench::Corpus out;
+		size_t macroCount;
+
+		size_t pick(size_t n) { return std::uniform_int_distribution<size_t>(0, n - 1)(rng); }
+
+		//! Appends text, converting its newlines if we're making CRLF input
+		void add(const std::string& s)
+		{
+			if (kind != Bench::CorpusKind::Crlf) {
+				out.text += s;
+				return;
+			}
+			for (char c : s) {
+				if (c == '\n')
+					out.text += '\r';
+				out.text += c;
+			}
+		}
+
+		//! Returns nested macros, depth deep (integrals and summations, which expand their arguments)
+		std::string nested(unsigned int depth)
+		{
+			++macroCount;
+			if (depth == 0)
+				return macros[2 + pick(3)];
+			const std::string inner = nested(depth - 1);
+			return pick(2) == 0 ? "\\integral[inf]{" + inner + "}{x}" : "\\summ[mir]{" + inner + "}{N}";
+		}
+
+		void paragraph()
+		{
+			using Bench::CorpusKind;
+			switch (kind) {
+				case CorpusKind::Prose:
+					for (size_t line = 0; line < 6; ++line) {
+						for (size_t w = 0; w < 12; ++w) {
+							add(words[pick(words.size())]);
+							add(" ");
+						}
+						// The occasional bit of inline math
+						if (pick(4) == 0) {
+							add(std::string("$") + macros[2 + pick(3)] + "$ ");
+							++macroCount;
+						}
+						add("\n");
+					}
+					break;
+
+				case CorpusKind::MathDense:
+				case CorpusKind::Crlf:
+				case CorpusKind::LongLines:
+					// Long lines only break at the end of each paragraph
+					add("\\[\n");
+					for (size_t line = 0; line < 8; ++line) {
+						for (size_t m = 0; m < 6; ++m) {
+							add(macros[pick(macros.size() - 1)]);
+							add(" ");
+							++macroCount;
+						}
+						if (kind != CorpusKind::LongLines)
+							add("\n");
+					}
+					add(std::string(macros.back()) + "\n");
+					++macroCount;
+					add("\\]\n");
+					break;
+
+				case CorpusKind::Nested:
+					for (size_t line = 0; line < 4; ++line)
+						add("$" + nested(4 + pick(5)) + "$\n");
+					break;
+
+				case CorpusKind::OptionHeavy:
+					add("\\begin{align*}\n");
+					for (size_t line = 0; line < 8; ++line) {
+						add(optionMacros[pick(optionMacros.size())]);
+						add(" \\\\\n");
+						++macroCount;
+					}
+					add("\\end{align*}\n");
+					break;
+
+				case CorpusKind::Listings: {
+					for (size_t line = 0; line < 3; ++line) {
+						for (size_t w = 0; w < 12; ++w) {
+							add(words[pick(words.size())]);
+							add(" ");
+						}
+						add("\n");
+					}
+					add(std::string("$") + macros[2 + pick(3)] + "$\n");
+					++macroCount;
+
+					const std::string env = listingEnvironments[pick(listingEnvironments.size())];
+					add("\\begin{" + env + "}" + (env == "minted" ? "{c}" : "") + "\n");
+					for (size_t line = 0; line < 12 + pick(24); ++line) {
+						add(codeLines[pick(codeLines.size())]);
+						add("\n");
+					}
+					add("\\end{" + env + "}\n");
+					break;
+				}
+			}
+			add("\n");
+		}
+	};
+}
+
+const char* Bench::corpusName(CorpusKind kind)
+{
+	switch (kind) {
+		case CorpusKind::Prose: return "prose";
+		case CorpusKind::MathDense: return "math-dense";
+		case CorpusKind::Nested: return "nested";
+		case CorpusKind::LongLines: return "long-lines";
+		case CorpusKind::Crlf: return "crlf";
+		case CorpusKind::OptionHeavy: return "option-heavy";
+		case CorpusKind::Listings: return "listings";
+	}
+	return "unknown";
+}
+
+Bench::Corpus Bench::generateCorpus(CorpusKind kind, size_t size, unsigned int seed)
+{
+	return Generator(kind, seed).generate(size);
+}
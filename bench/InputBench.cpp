@@ -0,0 +1,80 @@
+#include "precomp.hpp"
+
+#include "Bench.hpp"
+
+#include <unistd.h>
+
+#include "InputFile.hpp"
+
+namespace {
+	//! Reads a "Foo: 1234 kB" line from /proc/self/status, returning the number, or -1 if it isn't there
+	long procStatusKiB(const char* field)
+	{
+		std::ifstream status("/proc/self/status");
+		std::string line;
+		const size_t len = strlen(field);
+		while (std::getline(status, line)) {
+			if (line.compare(0, len, field) == 0 && line.size() > len && line[len] == ':')
+				return strtol(line.c_str() + len + 1, nullptr, 10);
+		}
+		return -1;
+	}
+
+	//! Touches every page so it is resident, as the parser would
+	unsigned int touch(const char* data, size_t size)
+	{
+		unsigned int sum = 0;
+		for (size_t i = 0; i < size; i += 4096)
+			sum += static_cast<unsigned char>(data[i]);
+		return sum;
+	}
+}
+
+void Bench::inputMemory(Results& r)
+{
+	static const size_t fileSize = 64 * 1024 * 1024;
+
+	char path[] = "/tmp/semtex-bench-XXXXXX";
+	const int fd = mkstemp(path);
+	if (fd < 0) {
+		printf("InputFile: could not create a temporary file\n");
+		return;
+	}
+	{
+		const std::string line = "Some prose, $x --> y$, and \\deriv{y}{x} for good measure.\n";
+		std::string chunk;
+		while (chunk.size() < 1024 * 1024)
+			chunk += line;
+		for (size_t written = 0; written < fileSize; written += chunk.size()) {
+			if (write(fd, chunk.data(), chunk.size()) != static_cast<ssize_t>(chunk.size()))
+				break;
+		}
+		close(fd);
+	}
+
+	unsigned int sink = 0;
+	{
+		const long anonBefore = procStatusKiB("RssAnon");
+		const InputFile in(path);
+		sink += touch(in.data(), in.size());
+		const long anon = procStatusKiB("RssAnon") - anonBefore;
+		printf("InputFile (%s): +%ld KiB anonymous, %ld KiB file-backed resident\n",
+		       in.isMapped() ? "mapped" : "read", anon, procStatusKiB("RssFile"));
+		r.add("InputFile", "anonymous memory", anon, "KiB");
+	}
+	{
+		// What processFile used to do: read the whole file into a heap buffer
+		const long anonBefore = procStatusKiB("RssAnon");
+		std::ifstream inf(path, std::ifstream::binary);
+		std::unique_ptr<char[]> buff(new char[fileSize]);
+		inf.read(buff.get(), fileSize);
+		sink += touch(buff.get(), fileSize);
+		const long anon = procStatusKiB("RssAnon") - anonBefore;
+		printf("Heap copy: +%ld KiB anonymous, %ld KiB file-backed resident\n", anon, procStatusKiB("RssFile"));
+		r.add("heap copy", "anonymous memory", anon, "KiB");
+	}
+	unlink(path);
+
+	if (sink == 42) // Keep the compiler from optimizing out the reads
+		printf(" ");
+}
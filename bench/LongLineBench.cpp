@@ -0,0 +1,62 @@
+#include "precomp.hpp"
+
+#include "Bench.hpp"
+
+#include "Context.hpp"
+#include "FileParser.hpp"
+
+namespace {
+	//! Dense math with no spaces, full of keys and things that almost are keys
+	const std::string kPattern = "a-->b<=c!=\"w\\deriv{y}{x}-<=-\\sinc\\sinx<-\\unit{mV}x_{i}^{2}";
+
+	//! Returns one line of about size bytes, in display math
+	std::string longLine(size_t size)
+	{
+		std::string ret = "\\[";
+		ret.reserve(size + kPattern.size() + 4);
+		while (ret.size() < size)
+			ret += kPattern;
+		return ret + "\\]";
+	}
+
+	//! Times parsing (and expanding) everything in input
+	double secondsToParse(const std::string& input, Context& ctxt)
+	{
+		return Bench::secondsPerCall([&] {
+			Parser p("bench", input.data(), input.data() + input.size(), ctxt);
+			p.parseLoop(true);
+		}, 0.2);
+	}
+}
+
+bool Bench::longLines(Results& r)
+{
+	// Twice the input should take about twice the time, however long its lines are.
+	// Allow plenty over that for a noisy machine. Anything quadratic takes four times as long.
+	static const size_t size = 10 * 1024 * 1024;
+	static const double maxRatio = 3.0;
+	static const int rounds = 5;
+
+	// Take the fastest of several alternating timings of each, so that a burst of load on the machine
+	// during one of them doesn't fail us
+	Context ctxt(nullptr);
+	const std::string halfLine = longLine(size / 2);
+	const std::string fullLine = longLine(size);
+	double half = std::numeric_limits<double>::max();
+	double full = std::numeric_limits<double>::max();
+	for (int i = 0; i < rounds; ++i) {
+		half = std::min(half, secondsToParse(halfLine, ctxt));
+		full = std::min(full, secondsToParse(fullLine, ctxt));
+	}
+	const double ratio = full / half;
+	printf("single 10 MB line: %.1f MB/s, %.2fx the time of half of it\n", size / full / 1e6, ratio);
+	r.add("longLine", "throughput", size / full / 1e6, "MB/s");
+	r.add("longLine", "scaling", ratio, "x");
+
+	if (ratio > maxRatio) {
+		fprintf(stderr, "FAIL: a single 10 MB line took %.2fx as long as half of it (at most %.1fx allowed)\n",
+		        ratio, maxRatio);
+		return false;
+	}
+	return true;
+}
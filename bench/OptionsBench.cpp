@@ -0,0 +1,34 @@
+#include "precomp.hpp"
+
+#include "Bench.hpp"
+
+#include "Context.hpp"
+#include "FileParser.hpp"
+
+void Bench::macroOptions(Results& r)
+{
+	// One options list per line, mixing every form the lexer accepts
+	static const std::string line = "[inf, lim, name=value, \"quoted flag\", other = \"x y\",\n  spaced flag ]\n";
+	static const size_t optionsPerLine = 6;
+	static const size_t lines = 10000;
+
+	std::string input;
+	input.reserve(line.size() * lines);
+	for (size_t i = 0; i < lines; ++i)
+		input += line;
+
+	Context ctxt(nullptr);
+	const double seconds = secondsPerCall([&] {
+		Parser p("bench", input.data(), input.data() + input.size(), ctxt);
+		while (true) {
+			p.readToNextLineText();
+			if (p.curr >= p.end)
+				break;
+			p.parseMacroOptions();
+		}
+	});
+
+	printf("parseMacroOptions: %.0f options/s (%.1f MB/s)\n",
+	       optionsPerLine * lines / seconds, input.size() / seconds / 1e6);
+	r.add("parseMacroOptions", "rate", optionsPerLine * lines / seconds, "options/s");
+}
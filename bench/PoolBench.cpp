@@ -0,0 +1,156 @@
+#include "precomp.hpp"
+
+#include "Bench.hpp"
+
+#include <unistd.h>
+
+#include "Context.hpp"
+#include "FileParser.hpp"
+
+namespace {
+	const size_t numIncludes = 200;
+
+	//! Writes a file, returning false if it couldn't be
+	bool writeFile(const std::string& name, const std::string& contents)
+	{
+		std::ofstream out(name, std::ofstream::binary);
+		out << contents;
+		return static_cast<bool>(out);
+	}
+
+	//! Removes the LaTeX files generated so far, so the next run starts from scratch
+	void removeGenerated(Context& ctxt)
+	{
+		for (const std::string& f : ctxt.generatedFiles)
+			unlink(f.c_str());
+		ctxt.generatedFiles.clear();
+	}
+
+	/*!
+	 * \brief How multiple files used to be processed: threads dequeuing with a 500 ms timeout,
+	 *        while the main thread polls every 250 ms until they are all idle and the queue is empty
+	 *
+	 * It is handed every file up front, since includes now go to the context's pool.
+	 */
+	void processPolling(const std::vector<std::string>& files, Context& ctxt)
+	{
+		static const std::chrono::milliseconds dequeueTimeout(500);
+
+		std::queue<std::string> q;
+		std::mutex qMutex;
+		std::condition_variable populated;
+		std::atomic_bool canDequeue(true);
+		std::atomic_bool exit(false);
+		std::atomic<unsigned int> busy(0);
+
+		const auto threadProc = [&] {
+			while (!exit) {
+				if (!canDequeue) {
+					std::this_thread::sleep_for(dequeueTimeout);
+					continue;
+				}
+				std::string fn;
+				{
+					std::unique_lock<std::mutex> lock(qMutex);
+					if (populated.wait_for(lock, dequeueTimeout, [&] { return !q.empty(); })) {
+						fn = std::move(q.front());
+						q.pop();
+						++busy;
+					}
+				}
+				if (!fn.empty()) {
+					processFile(fn, ctxt);
+					--busy;
+				}
+			}
+		};
+
+		// The root file was processed on the main thread, which started the others once it found includes
+		processFile(files.front(), ctxt);
+		std::vector<std::thread> threads;
+		for (unsigned int n = 0; n < std::max(2u, std::thread::hardware_concurrency()); ++n)
+			threads.emplace_back(threadProc);
+		{
+			std::lock_guard<std::mutex> lock(qMutex);
+			for (size_t i = 1; i < files.size(); ++i)
+				q.push(files[i]);
+			populated.notify_all();
+		}
+
+		while (true) {
+			canDequeue = false;
+			bool done = busy == 0;
+			{
+				std::lock_guard<std::mutex> lock(qMutex);
+				done = done && q.empty();
+			}
+			canDequeue = true;
+			if (done)
+				break;
+			std::this_thread::sleep_for(dequeueTimeout / 2);
+		}
+		exit = true;
+		for (auto& t : threads)
+			t.join();
+	}
+}
+
+void Bench::includePool(Results& r)
+{
+	char dirTemplate[] = "/tmp/semtex-bench-XXXXXX";
+	if (mkdtemp(dirTemplate) == nullptr) {
+		printf("WorkerPool: could not create a temporary directory\n");
+		return;
+	}
+	const std::string dir = dirTemplate;
+
+	// A root file that includes numIncludes others, each with a bit of everything to expand
+	std::string body;
+	for (size_t i = 0; i < 50; ++i) {
+		body += "Some prose, $x --> y$, \\deriv{y}{x}, and \\integral[inf]{f(x)}{x}.\n"
+		        "\\summ[mir]{n}{N} \\unit{mV}\n\n";
+	}
+
+	std::vector<std::string> files = {dir + "/main.stex"};
+	std::string root = body;
+	for (size_t i = 0; i < numIncludes; ++i) {
+		const std::string name = dir + "/part" + std::to_string(i);
+		root += "\\input{" + name + "}\n";
+		files.push_back(name + ".stex");
+		if (!writeFile(files.back(), body)) {
+			printf("WorkerPool: could not write %s\n", files.back().c_str());
+			return;
+		}
+	}
+	// The polling version is handed the included files directly
+	files.front() = dir + "/flat.stex";
+	if (!writeFile(dir + "/main.stex", root) || !writeFile(files.front(), body)) {
+		printf("WorkerPool: could not write the root file\n");
+		return;
+	}
+
+	{
+		Context ctxt(nullptr);
+		const double secs = Bench::secondsPerCall([&] {
+			enqueueFile(dir + "/main.stex", ctxt);
+			ctxt.pool.run();
+			removeGenerated(ctxt);
+		});
+		printf("%zu includes, work-stealing pool: %.2f ms\n", numIncludes, secs * 1000);
+		r.add("includes/work-stealing pool", "time", secs * 1000, "ms");
+	}
+	{
+		Context ctxt(nullptr);
+		const double secs = Bench::secondsPerCall([&] {
+			processPolling(files, ctxt);
+			removeGenerated(ctxt);
+		}, 2.0);
+		printf("%zu includes, polling threads: %.2f ms\n", numIncludes, secs * 1000);
+		r.add("includes/polling threads", "time", secs * 1000, "ms");
+	}
+
+	for (const std::string& f : files)
+		unlink(f.c_str());
+	unlink((dir + "/main.stex").c_str());
+	rmdir(dir.c_str());
+}
@@ -0,0 +1,40 @@
+#include "precomp.hpp"
+
+#include "Bench.hpp"
+
+#include "Version.hpp"
+
+namespace {
+	//! Quotes a string for JSON
+	std::string jsonQuoted(const std::string& s)
+	{
+		std::string ret = "\"";
+		for (char c : s) {
+			if (c == '"' || c == '\\') {
+				ret += '\\';
+				ret += c;
+			}
+			else if (static_cast<unsigned char>(c) < 0x20) {
+				char escaped[8];
+				snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+				ret += escaped;
+			}
+			else {
+				ret += c;
+			}
+		}
+		return ret + "\"";
+	}
+}
+
+void Bench::Results::writeJson(FILE* out) const
+{
+	fprintf(out, "{\n\t\"version\": %s,\n\t\"results\": [", jsonQuoted(SEMTEX_VERSION).c_str());
+	for (size_t i = 0; i < results.size(); ++i) {
+		const Result& r = results[i];
+		fprintf(out, "%s\n\t\t{\"benchmark\": %s, \"metric\": %s, \"value\": %.6g, \"unit\": %s}",
+		        i == 0 ? "" : ",", jsonQuoted(r.benchmark).c_str(), jsonQuoted(r.metric).c_str(), r.value,
+		        jsonQuoted(r.unit).c_str());
+	}
+	fprintf(out, "\n\t]\n}\n");
+}
@@ -0,0 +1,63 @@
+#include "precomp.hpp"
+
+#include "Bench.hpp"
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace {
+	//! The SemTeX binary timed, which the bench target builds alongside us
+	const char* const kSemtex = "./semtex";
+
+	/*!
+	 * \brief Runs SemTeX on empty input, from stdin to stdout, and waits for it to exit
+	 * \returns false if it couldn't be run or failed
+	 */
+	bool runEmpty()
+	{
+		posix_spawn_file_actions_t actions;
+		posix_spawn_file_actions_init(&actions);
+		posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+		posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+		char arg0[] = "semtex";
+		char arg1[] = "-E";
+		char arg2[] = "-";
+		char* argv[] = {arg0, arg1, arg2, nullptr};
+
+		pid_t pid;
+		const int err = posix_spawn(&pid, kSemtex, &actions, nullptr, argv, environ);
+		posix_spawn_file_actions_destroy(&actions);
+		if (err != 0)
+			return false;
+
+		int status;
+		while (waitpid(pid, &status, 0) < 0) {
+			if (errno != EINTR)
+				return false;
+		}
+		return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	}
+}
+
+void Bench::startup(Results& r, size_t allocationsBeforeMain)
+{
+	// Everything SemTeX sets up before main (replacer tables, the key matcher, trigger sets, etc.)
+	// is also set up before ours, so count what that allocated.
+	printf("static initialization: %zu allocations\n", allocationsBeforeMain);
+	r.add("staticInit", "allocations", static_cast<double>(allocationsBeforeMain), "allocations");
+
+	if (access(kSemtex, X_OK) != 0 || !runEmpty()) {
+		printf("startup: skipped (could not run %s)\n", kSemtex);
+		return;
+	}
+
+	// An empty run is nothing but startup and shutdown
+	const double ms = secondsPerCall(runEmpty, 1.0) * 1e3;
+	printf("startup (semtex -E - on empty input): %.2f ms\n", ms);
+	r.add("startup", "time", ms, "ms");
+}
@@ -0,0 +1,183 @@
+#include "precomp.hpp"
+
+#include "Bench.hpp"
+
+#include <fcntl.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "Context.hpp"
+#include "ExpansionCache.hpp"
+#include "FileParser.hpp"
+#include "OutputWriter.hpp"
+#include "TableReplacer.hpp"
+
+namespace {
+	//! How big each corpus is
+	const size_t kCorpusSize = 4 * 1024 * 1024;
+
+	//! Prints and records the throughput of something that handles bytes of input, macros at a time
+	void report(Bench::Results& r, const std::string& name, double seconds, size_t bytes, size_t macros)
+	{
+		const double mbPerSec = bytes / seconds / 1e6;
+		const double nsPerMacro = seconds * 1e9 / macros;
+		printf("%s: %.1f MB/s, %.1f ns/macro\n", name.c_str(), mbPerSec, nsPerMacro);
+		r.add(name, "throughput", mbPerSec, "MB/s");
+		r.add(name, "cost", nsPerMacro, "ns/macro");
+	}
+
+	//! How many keys are in the replacement table benchmarked
+	const size_t kTableSize = 10000;
+
+	//! Parses (and expands) everything in input
+	void parseAll(const std::string& input, Context& ctxt)
+	{
+		Parser p("bench", input.data(), input.data() + input.size(), ctxt);
+		p.parseLoop(true);
+	}
+}
+
+void Bench::throughput(Results& r)
+{
+	Context ctxt(nullptr);
+
+	// The whole parser, on every kind of input
+	for (CorpusKind kind : allCorpusKinds) {
+		const Corpus c = generateCorpus(kind, kCorpusSize);
+		const double seconds = secondsPerCall([&] { parseAll(c.text, ctxt); });
+		report(r, std::string("parseLoop/") + corpusName(kind), seconds, c.text.size(), c.macros);
+	}
+
+	// The same, with repeated invocations only expanded once
+	for (CorpusKind kind : {CorpusKind::MathDense, CorpusKind::Nested}) {
+		const Corpus c = generateCorpus(kind, kCorpusSize);
+		ExpansionCache expansions;
+		ctxt.expansions = &expansions;
+		const double seconds = secondsPerCall([&] { parseAll(c.text, ctxt); });
+		ctxt.expansions = nullptr;
+
+		const double hitRate = 100.0 * expansions.hits() / (expansions.hits() + expansions.misses());
+		report(r, std::string("parseLoop/") + corpusName(kind) + "/cached", seconds, c.text.size(), c.macros);
+		printf("parseLoop/%s/cached: %.1f%% of expansions cached\n", corpusName(kind), hitRate);
+		r.add(std::string("parseLoop/") + corpusName(kind) + "/cached", "hitRate", hitRate, "%");
+	}
+
+	// Options and arguments on their own, one list per line
+	{
+		static const std::string line = "[inf, lim, \"quoted flag\", name = value]\n";
+		static const size_t lines = 100000;
+		std::string input;
+		for (size_t i = 0; i < lines; ++i)
+			input += line;
+
+		const double seconds = secondsPerCall([&] {
+			Parser p("bench", input.data(), input.data() + input.size(), ctxt);
+			while (p.curr < p.end) {
+				p.parseMacroOptions();
+				p.readToNextLineText();
+			}
+		});
+		report(r, "parseMacroOptions", seconds, input.size(), lines);
+	}
+	{
+		static const std::string line = "{f(x)}{x}{a}{\\frac{b}{2}}\n";
+		static const size_t lines = 100000;
+		std::string input;
+		for (size_t i = 0; i < lines; ++i)
+			input += line;
+
+		const double seconds = secondsPerCall([&] {
+			Parser p("bench", input.data(), input.data() + input.size(), ctxt);
+			while (p.curr < p.end) {
+				p.parseBracketArgs();
+				p.readToNextLineText();
+			}
+		});
+		report(r, "parseBracketArgs", seconds, input.size(), lines);
+	}
+
+	// The output writer, writing the source text between replacements and the replacements themselves
+	// (as processFile does) to /dev/null
+	{
+		const Corpus c = generateCorpus(CorpusKind::MathDense, kCorpusSize);
+		Parser p("bench", c.text.data(), c.text.data() + c.text.size(), ctxt);
+		p.parseLoop(true);
+
+		std::vector<StringView> spans;
+		size_t total = 0;
+		const char* at = c.text.data();
+		for (const Replacement& rep : p.replacements) {
+			if (rep.start < at)
+				continue; // Nested in the last one
+			spans.emplace_back(at, rep.start - at);
+			spans.push_back(rep.text(p.replacementText));
+			at = rep.end;
+		}
+		spans.emplace_back(at, c.text.data() + c.text.size() - at);
+		for (const StringView& s : spans)
+			total += s.size();
+
+		const int devNull = open("/dev/null", O_WRONLY);
+		const double seconds = secondsPerCall([&] {
+			OutputWriter w(devNull, "/dev/null", total);
+			for (const StringView& s : spans)
+				w.write(s);
+			w.flush();
+		});
+		close(devNull);
+		report(r, "OutputWriter", seconds, total, p.replacements.size());
+	}
+
+	// Each replacer, on input that is nothing but its macro (in display math, where they apply)
+	static const std::array<std::pair<const char*, const char*>, 6> replacers = {{
+		{"IntegralReplacer", "\\integral[inf]{f(x)}{x} "},
+		{"SummationReplacer", "\\summ[mir]{n}{N} "},
+		{"DerivReplacer", "\\deriv{y}{x}{2} "},
+		{"UnitReplacer", "\\unit{mV} "},
+		{"DirectReplacer", "x --> y "},
+		{"PiecewiseReplacer", "\\begin{piecewise}{f(x)}\n\\piece{1}{x > 0}\n\\piece{0}\n\\end{piecewise}\n"}
+	}};
+	for (const auto& rep : replacers) {
+		static const size_t reps = 20000;
+		std::string input = "\\[\n";
+		for (size_t i = 0; i < reps; ++i)
+			input += rep.second;
+		input += "\\]\n";
+
+		const double seconds = secondsPerCall([&] { parseAll(input, ctxt); });
+		report(r, rep.first, seconds, input.size(), reps);
+	}
+
+	// A big replacement table, loaded (already compiled) and looked up in
+	{
+		char dirTemplate[] = "/tmp/semtex-bench-XXXXXX";
+		const std::string dir = mkdtemp(dirTemplate);
+		const std::string config = dir + "/semtex.conf";
+		const std::string image = dir + "/.semtex-tables";
+		{
+			std::ofstream out(config);
+			for (size_t i = 0; i < kTableSize; ++i)
+				out << "replace \\sym" << i << " \\mathsf{s" << i << "}\n";
+		}
+		// Backdate it, or it's too new to trust and is compiled again every time it's loaded
+		const struct timeval past[2] = {{0, 0}, {0, 0}};
+		utimes(config.c_str(), past);
+
+		Context tableCtxt(nullptr);
+		std::unique_ptr<TableReplacer> table = loadTables(config, image, tableCtxt);
+		const double loadSeconds = secondsPerCall([&] { table = loadTables(config, image, tableCtxt); });
+		printf("TableReplacer load (%zu keys): %.1f us\n", kTableSize, loadSeconds * 1e6);
+		r.add("TableReplacer", "load", loadSeconds * 1e6, "us");
+
+		static const size_t reps = 20000;
+		std::string input;
+		for (size_t i = 0; i < reps; ++i)
+			input += "\\sym" + std::to_string(i * 7919 % kTableSize) + " ";
+		const double seconds = secondsPerCall([&] { parseAll(input, tableCtxt); });
+		report(r, "TableReplacer", seconds, input.size(), reps);
+
+		unlink(image.c_str());
+		unlink(config.c_str());
+		rmdir(dir.c_str());
+	}
+}
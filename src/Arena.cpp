@@ -0,0 +1,28 @@
+#include "precomp.hpp"
+
+#include "Arena.hpp"
+
+const size_t Arena::kBlockSize;
+
+void* Arena::allocate(size_t bytes, size_t align)
+{
+	while (blockIndex < blocks.size()) {
+		Block& b = blocks[blockIndex];
+		const size_t start = (used + align - 1) & ~(align - 1);
+		if (start + bytes <= b.size) {
+			used = start + bytes;
+			return b.data.get() + start;
+		}
+		// Doesn't fit. Move on to the next block.
+		++blockIndex;
+		used = 0;
+	}
+
+	// We're out of blocks. Make a new one big enough for this request.
+	// (new[] returns memory aligned for any fundamental type, so the start of the block is suitably aligned.)
+	const size_t size = std::max(kBlockSize, bytes);
+	blocks.push_back({std::unique_ptr<char[]>(new char[size]), size});
+	blockIndex = blocks.size() - 1;
+	used = bytes;
+	return blocks.back().data.get();
+}
@@ -0,0 +1,46 @@
+#ifndef __ARENA_HPP__
+#define __ARENA_HPP__
+
+/*!
+ * \brief A bump allocator for short-lived scratch data
+ *
+ * Memory is handed out from large blocks and is only ever released all at once by reset(),
+ * which keeps the blocks around for reuse. After warming up, allocating from an arena
+ * never touches the heap.
+ */
+class Arena {
+public:
+	Arena() : blocks(), blockIndex(0), used(0) { }
+
+	/*!
+	 * \brief Allocates uninitialized memory that lives until the next reset()
+	 * \param bytes The number of bytes to allocate
+	 * \param align The alignment required (must be a power of two)
+	 */
+	void* allocate(size_t bytes, size_t align = alignof(std::max_align_t));
+
+	//! Releases everything allocated so far (but keeps the memory for reuse)
+	void reset()
+	{
+		blockIndex = 0;
+		used = 0;
+	}
+
+	// No copy or assignment
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+private:
+	static const size_t kBlockSize = 4096; //!< Size of a normal block. Larger requests get their own.
+
+	struct Block {
+		std::unique_ptr<char[]> data;
+		size_t size;
+	};
+
+	std::vector<Block> blocks;
+	size_t blockIndex; //!< Index of the block we are currently allocating from
+	size_t used; //!< Bytes used in the current block
+};
+
+#endif
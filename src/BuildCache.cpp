@@ -0,0 +1,192 @@
+#include "precomp.hpp"
+
+#include "BuildCache.hpp"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Exceptions.hpp"
+#include "IncludeGraph.hpp"
+#include "Version.hpp"
+
+namespace {
+	/*!
+	 * The first line of every cache file. The number goes up whenever the same input can produce different output,
+	 * so outputs recorded by an older build aren't trusted (2: keys only apply in the mode they belong in).
+	 */
+	const char kHeader[] = "semtex-cache 2 " SEMTEX_VERSION;
+
+	//! Escapes backslashes and newlines so text fits on one line
+	std::string escape(const std::string& s)
+	{
+		std::string ret;
+		for (char c : s) {
+			if (c == '\\')
+				ret += "\\\\";
+			else if (c == '\n')
+				ret += "\\n";
+			else
+				ret += c;
+		}
+		return ret;
+	}
+
+	//! Undoes escape()
+	std::string unescape(const std::string& s)
+	{
+		std::string ret;
+		for (size_t i = 0; i < s.size(); ++i) {
+			if (s[i] == '\\' && i + 1 < s.size()) {
+				++i;
+				ret += s[i] == 'n' ? '\n' : s[i];
+			}
+			else {
+				ret += s[i];
+			}
+		}
+		return ret;
+	}
+
+	//! Returns the rest of a line after skipping its first n space-separated fields
+	std::string afterFields(const std::string& line, size_t n)
+	{
+		size_t at = 0;
+		for (size_t i = 0; i < n && at != std::string::npos; ++i) {
+			at = line.find(' ', at);
+			if (at != std::string::npos)
+				++at;
+		}
+		return at == std::string::npos ? std::string() : line.substr(at);
+	}
+}
+
+void OutputHasher::writeWithNewlines(StringView text, StringView newline)
+{
+	const char* curr = text.begin();
+	const char* const end = text.end();
+	while (curr < end) {
+		const char* nl = static_cast<const char*>(memchr(curr, '\n', end - curr));
+		if (nl == nullptr) {
+			write(curr, end - curr);
+			break;
+		}
+		write(curr, nl - curr);
+		write(newline);
+		curr = nl + 1;
+	}
+}
+
+int64_t FileStamp::trustedMtime(int64_t now) const
+{
+	// Files modified less than this long (in nanoseconds) before they were stamped aren't trusted
+	static const int64_t racyWindow = 2000000000LL;
+	return now - mtime < racyWindow ? 0 : mtime;
+}
+
+int64_t FileStamp::now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+FileStamp FileStamp::of(const std::string& path)
+{
+	FileStamp ret;
+	struct stat st;
+	if (stat(path.c_str(), &st) == 0) {
+		ret.exists = true;
+		ret.size = st.st_size;
+		ret.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+	}
+	return ret;
+}
+
+BuildCache::BuildCache(const std::string& p, const std::string& settings)
+	: path(p), header(std::string(kHeader) + (settings.empty() ? "" : " " + settings)), entriesMutex(), entries(), dirty(false)
+{
+	std::ifstream in(path);
+	std::string line;
+	if (!std::getline(in, line) || line != header)
+		return; // No cache yet, or one from another version or with other settings
+
+	Entry* e = nullptr;
+	while (std::getline(in, line)) {
+		std::istringstream fields(line);
+		std::string kind;
+		fields >> kind;
+		if (kind == "source") {
+			Entry fresh;
+			fields >> fresh.source.size >> fresh.source.mtime >> std::hex >> fresh.sourceHash;
+			fresh.source.exists = true;
+			e = &(entries[afterFields(line, 4)] = std::move(fresh));
+		}
+		else if (e == nullptr) {
+			continue;
+		}
+		else if (kind == "output") {
+			fields >> e->outputStamp.size >> e->outputStamp.mtime;
+			e->outputStamp.exists = true;
+			e->output = afterFields(line, 3);
+		}
+		else if (kind == "warning" || kind == "include") {
+			e->log.push_back({unescape(afterFields(line, 1)), kind == "include"});
+		}
+	}
+}
+
+bool BuildCache::lookup(const std::string& source, Entry& e) const
+{
+	std::lock_guard<std::mutex> lock(entriesMutex);
+	const auto it = entries.find(IncludeGraph::canonicalPath(source));
+	if (it == entries.end())
+		return false;
+
+	e = it->second;
+	return true;
+}
+
+void BuildCache::store(const std::string& source, Entry&& e)
+{
+	const int64_t now = FileStamp::now();
+	e.source.mtime = e.source.trustedMtime(now);
+	e.outputStamp.mtime = e.outputStamp.trustedMtime(now);
+
+	const std::string key = IncludeGraph::canonicalPath(source);
+	std::lock_guard<std::mutex> lock(entriesMutex);
+	entries[key] = std::move(e);
+	dirty = true;
+}
+
+void BuildCache::save() const
+{
+	std::lock_guard<std::mutex> lock(entriesMutex);
+	if (!dirty)
+		return;
+
+	std::ostringstream out;
+	out << header << '\n';
+	for (const auto& kv : entries) {
+		const Entry& e = kv.second;
+		out << "source " << e.source.size << ' ' << e.source.mtime << ' '
+		    << std::hex << e.sourceHash << std::dec << ' ' << kv.first << '\n';
+		if (!e.output.empty())
+			out << "output " << e.outputStamp.size << ' ' << e.outputStamp.mtime << ' ' << e.output << '\n';
+		for (const auto& l : e.log)
+			out << (l.isInclude ? "include " : "warning ") << escape(l.text) << '\n';
+	}
+	// Put it in place whole, so a crash can't leave half a cache behind
+	replaceFile(path, out.str(), "build cache");
+}
+
+void replaceFile(const std::string& path, StringView contents, const std::string& what)
+{
+	const std::string tmp = path + ".tmp";
+	{
+		std::ofstream out(tmp, std::ofstream::trunc | std::ofstream::binary);
+		out.write(contents.data(), contents.size());
+		if (!out)
+			throw Exceptions::FileException("Error: Could not write " + what + " " + tmp, __FUNCTION__);
+	}
+	if (rename(tmp.c_str(), path.c_str()) != 0)
+		throw Exceptions::FileException("Error: Could not replace " + what + " " + path, __FUNCTION__);
+}
@@ -0,0 +1,138 @@
+#ifndef __BUILD_CACHE_HPP__
+#define __BUILD_CACHE_HPP__
+
+#include "FileParser.hpp"
+#include "StringView.hpp"
+
+//! Hashes bytes with 64-bit FNV-1a. Pass the previous result as hash to continue hashing where it left off.
+inline uint64_t hashBytes(const char* data, size_t len, uint64_t hash = 0xcbf29ce484222325ULL)
+{
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= static_cast<unsigned char>(data[i]);
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/*!
+ * \brief Takes the place of an OutputWriter to find the size and hash of what would be written,
+ *        without writing anything
+ */
+class OutputHasher {
+public:
+	OutputHasher() : hash(hashBytes(nullptr, 0)), length(0) { }
+
+	void write(const char* data, size_t len)
+	{
+		hash = hashBytes(data, len, hash);
+		length += len;
+	}
+
+	void write(StringView s) { write(s.data(), s.size()); }
+
+	//! See OutputWriter::writeWithNewlines
+	void writeWithNewlines(StringView text, StringView newline);
+
+	uint64_t value() const { return hash; }
+
+	size_t size() const { return length; }
+
+private:
+	uint64_t hash;
+	size_t length;
+};
+
+//! Enough about a file to tell (cheaply) if it has changed
+struct FileStamp {
+	bool exists = false;
+	uint64_t size = 0;
+	int64_t mtime = 0; //!< Modification time in nanoseconds, or 0 if it can't be trusted (see trustedMtime())
+
+	bool operator==(const FileStamp& o) const { return exists == o.exists && size == o.size && mtime == o.mtime; }
+	bool operator!=(const FileStamp& o) const { return !(*this == o); }
+
+	/*!
+	 * \brief Returns mtime, or 0 if the file was modified so shortly before now that it could still change
+	 *        without its mtime doing so (within the file system's timestamp granularity)
+	 *
+	 * Anything recorded with a 0 mtime never matches the file's real stamp, so it is redone next time.
+	 */
+	int64_t trustedMtime(int64_t now) const;
+
+	//! Returns the current time, in the same units as mtime
+	static int64_t now();
+
+	//! Stats a file
+	static FileStamp of(const std::string& path);
+};
+
+/*!
+ * \brief Writes a file by writing a temporary one next to it and moving that into place,
+ *        so nobody ever reads half of it, even if we crash while writing
+ * \param what What the file is, for error messages (e.g. "build cache")
+ * \throws FileException if it can't be written
+ */
+void replaceFile(const std::string& path, StringView contents, const std::string& what);
+
+/*!
+ * \brief A per-project record of what SemTeX did with each file last time, so unchanged files can be skipped
+ *
+ * For each source, it keeps the source's stamp and content hash, the output generated from it (if any)
+ * and its stamp, and the warnings and includes found in it (so they can be replayed).
+ * It is kept in a text file (.semtex-cache, next to the file SemTeX was run on),
+ * and is thrown away entirely if it was written by a different version of SemTeX (or with other settings).
+ */
+class BuildCache {
+public:
+	//! What we know about a source file
+	struct Entry {
+		FileStamp source;
+		uint64_t sourceHash;
+		std::string output; //!< The LaTeX file generated from it, or empty if none was
+		FileStamp outputStamp;
+		std::vector<LogEntry> log; //!< Warnings and includes found in it, in order
+
+		Entry() : source(), sourceHash(0), output(), outputStamp(), log() { }
+	};
+
+	/*!
+	 * \brief Loads the cache from a file, if it exists and was written by this version of SemTeX
+	 *        with the same settings
+	 * \param path The file the cache is kept in
+	 * \param settings Anything else outputs depend on (such as the replacement tables in use), on one line
+	 */
+	explicit BuildCache(const std::string& path, const std::string& settings = std::string());
+
+	/*!
+	 * \brief Finds the entry for a source
+	 * \returns false if there isn't one
+	 */
+	bool lookup(const std::string& source, Entry& e) const;
+
+	/*!
+	 * \brief Adds or replaces the entry for a source
+	 *
+	 * Stamps taken within a couple of seconds of a file's modification time are not trusted,
+	 * since the file could change again without its size or time changing. Those files are hashed next time.
+	 */
+	void store(const std::string& source, Entry&& e);
+
+	/*!
+	 * \brief Writes the cache out (if anything changed), replacing the old file all at once
+	 * \throws FileException if it couldn't be written
+	 */
+	void save() const;
+
+	// No copy or assignment
+	BuildCache(const BuildCache&) = delete;
+	BuildCache& operator=(const BuildCache&) = delete;
+
+private:
+	const std::string path;
+	const std::string header; //!< The first line of the file, which has to match for it to be loaded
+	mutable std::mutex entriesMutex;
+	std::map<std::string, Entry> entries; //!< Keyed by canonical path
+	bool dirty;
+};
+
+#endif
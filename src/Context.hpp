@@ -1,19 +1,40 @@
 #ifndef __CONTEXT_HPP__
 #define __CONTEXT_HPP__
 
-#include "FileQueue.hpp"
+#include "IncludeGraph.hpp"
+#include "WorkerPool.hpp"
+
+class BuildCache;
+class ExpansionCache;
+class Stats;
+class TableReplacer;
 
 //! A global context. Used to pass around a ball of variables shared by lots of the code.
 struct Context {
 	bool verbose; //!< True to print additional information to stdout
+	bool stream; //!< True to read files in chunks instead of all at once (see processStream())
+	bool parallelParse; //!< True to split large files into pieces and parse them in parallel
 	std::atomic_bool error; //!< Error flag. When this is raised, threads should no longer process more files
+	std::string outputDir; //!< Where generated LaTeX files go, or empty to put them next to their sources
+	std::vector<std::string> rawEnvironments; //!< Environments copied through untouched, besides verbatim, lstlisting, etc. (see --raw-env)
 	std::vector<std::string> generatedFiles; //!< LaTeX files generated by SemTeX
 	std::mutex generatedFilesMutex; //!< A mutex for generatedFiles
-	FileQueue queue; //!< Queue of SemTeX files to be processed
+	WorkerPool pool; //!< Processes SemTeX files (see enqueueFile())
+	IncludeGraph includes; //!< Which files include which, so that each is processed once
+	BuildCache* cache; //!< What was done with each file last time, or nullptr to process everything (see --incremental)
+	Stats* stats; //!< Where each file's timings and counts go, or nullptr to not collect them (see --stats)
+	TableReplacer* table; //!< Replacements from the project's config file, or nullptr if it has none (see loadTables())
+	ExpansionCache* expansions; //!< Where pure replacers' expansions are cached, or nullptr to not cache them
+
+	//! Constructor (just hands callback to the pool)
+	Context(WorkerPool::StartCallback cb)
+		: verbose(false), stream(false), parallelParse(false), error(false), outputDir(), rawEnvironments(),
+		  generatedFiles(), generatedFilesMutex(), pool(cb, WorkerPool::availableCpus()), includes(), cache(nullptr),
+		  stats(nullptr), table(nullptr), expansions(nullptr) { }
 
-	//! Constructor (just hands callback to queue)
-	Context(FileQueue::QueueUsedCallback cb)
-		: verbose(false), error(false), generatedFiles(), generatedFilesMutex(), queue(cb) { }
+	// No copy or assignment
+	Context(const Context&) = delete;
+	Context& operator=(const Context&) = delete;
 };
 
 #endif
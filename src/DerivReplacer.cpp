@@ -5,17 +5,13 @@
 #include "Exceptions.hpp"
 #include "FileParser.hpp"
 
-DerivReplacer::DerivReplacer()
-	: Replacer({"\\deriv"})
-{ }
-
-void DerivReplacer::replace(const std::string& matchedKey, Parser& p)
+void DerivReplacer::replace(StringView matchedKey, Parser& p)
 {
 	const char* start = p.curr;
 	p.curr += matchedKey.length();
 
-	std::unique_ptr<MacroOptions> options;
-	decltype(p.parseBracketArgs()) argList;
+	MacroOptions options;
+	ArgList argList;
 	try {
 		options = p.parseMacroOptions();
 		argList = p.parseBracketArgs();
@@ -24,13 +20,13 @@ void DerivReplacer::replace(const std::string& matchedKey, Parser& p)
 		throw Exceptions::InvalidInputException(ex.message + " in " + matchedKey, __FUNCTION__);
 	}
 
-	if (options->opts.size() != 0)
+	if (options.opts.size() != 0)
 		p.errorOnLine(matchedKey + " does not take options");
 
-	if (options->flags.size() != 0)
+	if (options.flags.size() != 0)
 		p.errorOnLine(matchedKey + " does not take flags");
 
-	const size_t numArgs = argList->size();
+	const size_t numArgs = argList.size();
 
 	if (numArgs < 1)
 		p.errorOnLine(matchedKey + " needs at least one argument");
@@ -38,24 +34,36 @@ void DerivReplacer::replace(const std::string& matchedKey, Parser& p)
 	if (numArgs > 3)
 		p.errorOnLine(matchedKey + " only takes one to three arguments");
 
-	std::string replacement = "\\frac{\\mathrm{d}";
+	ReplacementText replacement(p);
+	replacement += "\\frac{\\mathrm{d}";
 
 	switch (numArgs) {
 		case 3:
-			replacement += "^{" + argList->at(2) + "} " + argList->at(0) + "}";
-			replacement += "{\\mathrm{d} " + argList->at(1) + "^{" + argList->at(2) + "}}";
+			replacement += "^{";
+			replacement += argList[2];
+			replacement += "} ";
+			replacement += argList[0];
+			replacement += "}{\\mathrm{d} ";
+			replacement += argList[1];
+			replacement += "^{";
+			replacement += argList[2];
+			replacement += "}}";
 			break;
 
 		case 2:
-			replacement += " " + argList->at(0) + "}";
-			replacement += "{\\mathrm{d} " + argList->at(1) + "}";
+			replacement += " ";
+			replacement += argList[0];
+			replacement += "}{\\mathrm{d} ";
+			replacement += argList[1];
+			replacement += "}";
 			break;
 
 		case 1:
+			replacement += "}{\\mathrm{d} ";
+			replacement += argList[0];
 			replacement += "}";
-			replacement += "{\\mathrm{d} " + argList->at(0) + "}";
 			break;
 	}
 
-	p.replacements.emplace_back(start, p.curr, std::move(replacement));
+	p.emit(start, replacement);
 }
@@ -5,11 +5,17 @@
 
 class DerivReplacer final : public Replacer {
 public:
-	DerivReplacer();
+	void replace(StringView matchedKey, Parser& p) override;
 
-	void replace(const std::string& matchedKey, Parser& p) override;
+	size_t numKeys() const override { return 1; }
+
+	StringView key(size_t) const override { return "\\deriv"; }
 
 	bool shouldRecurse() const override { return false;}
+
+	bool isPure() const override { return true; }
+
+	unsigned int modes() const override { return Math; }
 };
 
 #endif
@@ -5,58 +5,97 @@
 #include "Exceptions.hpp"
 #include "FileParser.hpp"
 
-DirectReplacer::DirectReplacer()
-	: replacements(
-		 // Relationsl operators
-		{{"<--","\\leftarrow"}, {"-->","\\rightarrow"},
-		 {"<==","\\Leftarrow"}, {"==>","\\Rightarrow"},
-		 {"<-->","\\leftrightarrow"}, {"<==>","\\Leftrightarrow"},
-		 {"!=","\\neq"}, {">=","\\geq"}, {"<=","\\leq"},
-		 // Greek letters
-		 {"\"t", "\\theta"},
-		 {"\"w", "\\omega"},
-		 {"\"e", "\\varepsilon"},
-		 {"\"r", "\\rho"},
-		 {"\"t", "\\tau"},
-		 {"\"y", "\\psi"},
-		 {"\"u", "\\upsilon"},
-		 {"\"p", "\\pi"},
-		 {"\"a", "\\alpha"},
-		 {"\"s", "\\sigma"},
-		 {"\"d", "\\delta"},
-		 {"\"f", "\\varphi"},
-		 {"\"g", "\\gamma"},
-		 {"\"h", "\\eta"},
-		 {"\"k", "\\kappa"},
-		 {"\"l", "\\lambda"},
-		 {"\"z", "\\zeta"},
-		 {"\"x", "\\xi"},
-		 {"\"c", "\\chi"},
-		 {"\"v", "\\varsigma"},
-		 {"\"b", "\\beta"},
-		 {"\"n", "\\nu"},
-		 {"\"m", "\\mu"},
-		 {"\"Q", "\\Theta"},
-		 {"\"W", "\\Omega"},
-		 {"\"Y", "\\Psi"},
-		 {"\"U", "\\Upsilon"},
-		 {"\"S", "\\Sigma"},
-		 {"\"D", "\\Delta"},
-		 {"\"F", "\\Phi"},
-		 {"\"G", "\\Gamma"},
-		 {"\"L", "\\Lambda"},
-		 {"\"X", "\\Xi"},
-		 // Math functions
-		 {"\\sinc", "\\mathrm{sinc}"}})
+namespace {
+	//! A key and what it is replaced with
+	struct Swap {
+		StringView key;
+		StringView replacement;
+	};
+
+	/*!
+	 * Relational operators, arrows, Greek letters and math functions, all of them only made in math (see modes()).
+	 * Sorted by key, byte by byte, so they can be binary searched (which is checked at compile time).
+	 */
+	constexpr Swap swaps[] = {
+		{"!=", "\\neq"},
+		{"\"D", "\\Delta"},
+		{"\"F", "\\Phi"},
+		{"\"G", "\\Gamma"},
+		{"\"L", "\\Lambda"},
+		{"\"Q", "\\Theta"},
+		{"\"S", "\\Sigma"},
+		{"\"U", "\\Upsilon"},
+		{"\"W", "\\Omega"},
+		{"\"X", "\\Xi"},
+		{"\"Y", "\\Psi"},
+		{"\"a", "\\alpha"},
+		{"\"b", "\\beta"},
+		{"\"c", "\\chi"},
+		{"\"d", "\\delta"},
+		{"\"e", "\\varepsilon"},
+		{"\"f", "\\varphi"},
+		{"\"g", "\\gamma"},
+		{"\"h", "\\eta"},
+		{"\"k", "\\kappa"},
+		{"\"l", "\\lambda"},
+		{"\"m", "\\mu"},
+		{"\"n", "\\nu"},
+		{"\"p", "\\pi"},
+		{"\"r", "\\rho"},
+		{"\"s", "\\sigma"},
+		{"\"t", "\\theta"},
+		{"\"u", "\\upsilon"},
+		{"\"v", "\\varsigma"},
+		{"\"w", "\\omega"},
+		{"\"x", "\\xi"},
+		{"\"y", "\\psi"},
+		{"\"z", "\\zeta"},
+		{"-->", "\\rightarrow"},
+		{"<--", "\\leftarrow"},
+		{"<-->", "\\leftrightarrow"},
+		{"<=", "\\leq"},
+		{"<==", "\\Leftarrow"},
+		{"<==>", "\\Leftrightarrow"},
+		{"==>", "\\Rightarrow"},
+		{">=", "\\geq"},
+		{"\\sinc", "\\mathrm{sinc}"}
+	};
+
+	constexpr size_t numSwaps = sizeof(swaps) / sizeof(swaps[0]);
+
+	//! True if a comes before b, byte by byte (as StringView::operator< has it)
+	constexpr bool before(StringView a, StringView b, size_t i = 0)
+	{
+		return i == b.size() ? false
+		       : i == a.size() ? true
+		       : a[i] != b[i] ? static_cast<unsigned char>(a[i]) < static_cast<unsigned char>(b[i])
+		       : before(a, b, i + 1);
+	}
+
+	constexpr bool sortedAndUnique(const Swap* s, size_t n)
+	{
+		return n < 2 || (before(s[0].key, s[1].key) && sortedAndUnique(s + 1, n - 1));
+	}
+
+	static_assert(sortedAndUnique(swaps, numSwaps), "Direct replacements must be sorted by key, with no repeats");
+}
+
+size_t DirectReplacer::numKeys() const
+{
+	return numSwaps;
+}
+
+StringView DirectReplacer::key(size_t i) const
 {
-	for (const auto& kp : replacements)
-		keySet.emplace(kp.first);
+	return swaps[i].key;
 }
 
-void DirectReplacer::replace(const std::string& matchedKey, Parser& p)
+void DirectReplacer::replace(StringView matchedKey, Parser& p)
 {
 	const char* start = p.curr;
 	p.curr += matchedKey.length();
 
-	p.replacements.emplace_back(start, p.curr, replacements.at(matchedKey));
+	const Swap* const s = std::lower_bound(swaps, swaps + numSwaps, matchedKey,
+	                                       [](const Swap& sw, StringView k) { return sw.key < k; });
+	p.emit(start, s->replacement);
 }
@@ -6,14 +6,19 @@
 //! Makes simple direct swaps (!= to \\neq, >= to \\geq, etc.)
 class DirectReplacer final : public Replacer {
 public:
-	DirectReplacer();
+	void replace(StringView matchedKey, Parser& p) override;
 
-	void replace(const std::string& matchedKey, Parser& p) override;
+	size_t numKeys() const override;
+
+	StringView key(size_t i) const override;
 
 	bool shouldRecurse() const override { return false; }
 
-private:
-	const std::unordered_map<std::string, std::string> replacements;
+	/*!
+	 * Every replacement is a math-mode command (\\neq, \\rightarrow, \\alpha, ...), which LaTeX rejects in running text,
+	 * where the keys mean something else anyway (an arrow drawn with dashes, babel's "a for an umlaut)
+	 */
+	unsigned int modes() const override { return Math; }
 };
 
 #endif
@@ -0,0 +1,52 @@
+#include "precomp.hpp"
+
+#include "ExpansionCache.hpp"
+
+#include "BuildCache.hpp"
+
+const ExpansionCache::Expansion* ExpansionCache::find(StringView invocation)
+{
+	const uint64_t hash = hashBytes(invocation.data(), invocation.size());
+	Shard& s = shards[hash % kNumShards];
+
+	std::lock_guard<std::mutex> lock(s.mutex);
+	const auto it = s.expansions.find(hash);
+	// A different invocation with the same hash is just a miss
+	if (it == s.expansions.end() || StringView(it->second.invocation) != invocation) {
+		++s.misses;
+		return nullptr;
+	}
+	++s.hits;
+	return &it->second;
+}
+
+void ExpansionCache::insert(Expansion&& e)
+{
+	const uint64_t hash = hashBytes(e.invocation.data(), e.invocation.size());
+	Shard& s = shards[hash % kNumShards];
+
+	std::lock_guard<std::mutex> lock(s.mutex);
+	// Whatever is already there stays, since someone might be reading it
+	if (s.expansions.size() < kMaxPerShard)
+		s.expansions.emplace(hash, std::move(e));
+}
+
+size_t ExpansionCache::hits() const
+{
+	size_t ret = 0;
+	for (const Shard& s : shards) {
+		std::lock_guard<std::mutex> lock(s.mutex);
+		ret += s.hits;
+	}
+	return ret;
+}
+
+size_t ExpansionCache::misses() const
+{
+	size_t ret = 0;
+	for (const Shard& s : shards) {
+		std::lock_guard<std::mutex> lock(s.mutex);
+		ret += s.misses;
+	}
+	return ret;
+}
@@ -0,0 +1,74 @@
+#ifndef __EXPANSION_CACHE_HPP__
+#define __EXPANSION_CACHE_HPP__
+
+#include "StringView.hpp"
+
+/*!
+ * \brief Remembers what macro invocations expanded to, so identical ones aren't parsed and expanded again
+ *
+ * Notes repeat the same invocations (\\deriv{y}{x}, \\unit{mV}, ...) over and over.
+ * The first time one is expanded, its replacement is stored under its text (key, options and arguments),
+ * and every later occurrence just copies the replacement out.
+ * Only replacers that declare themselves pure (see Replacer::isPure) are cached.
+ *
+ * The cache is shared by every worker. It is split into shards, each with its own lock,
+ * so workers rarely wait on each other. Expansions are never evicted or changed once stored
+ * (a shard just stops taking more once it is full), so they can be read without holding a lock.
+ */
+class ExpansionCache {
+public:
+	//! Longer invocations (options and arguments) aren't cached. They rarely repeat, and are slow to find and hash.
+	static const size_t kMaxInvocation = 256;
+
+	//! Source text spliced into a cached replacement
+	struct Splice {
+		uint32_t at; //!< Where in the replacement's text it goes
+		uint32_t offset; //!< Where it starts, relative to the start of the invocation
+		uint32_t length;
+	};
+
+	//! A cached replacement
+	struct Expansion {
+		std::string invocation; //!< The invocation it replaces, in full
+		std::string text; //!< The replacement's text, less any splices
+		std::vector<Splice> splices; //!< Sorted by at
+
+		Expansion() : invocation(), text(), splices() { }
+	};
+
+	ExpansionCache() : shards() { }
+
+	//! Returns the expansion of an invocation, or nullptr if it hasn't been stored
+	const Expansion* find(StringView invocation);
+
+	//! Stores the expansion of an invocation (unless there is no room left for it)
+	void insert(Expansion&& e);
+
+	//! The number of times find() found an expansion
+	size_t hits() const;
+
+	//! The number of times find() came up empty
+	size_t misses() const;
+
+	// No copy or assignment
+	ExpansionCache(const ExpansionCache&) = delete;
+	ExpansionCache& operator=(const ExpansionCache&) = delete;
+
+private:
+	static const size_t kNumShards = 64;
+	static const size_t kMaxPerShard = 1024; //!< Keeps a document of nothing but unique macros from growing us forever
+
+	//! Aligned to a cache line, so workers using neighbouring shards don't slow each other down
+	struct alignas(64) Shard {
+		mutable std::mutex mutex;
+		std::unordered_map<uint64_t, Expansion> expansions; //!< Keyed by the hash of the invocation
+		size_t hits;
+		size_t misses;
+
+		Shard() : mutex(), expansions(), hits(0), misses(0) { }
+	};
+
+	std::array<Shard, kNumShards> shards;
+};
+
+#endif
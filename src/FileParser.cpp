@@ -3,7 +3,15 @@
 #include "FileParser.hpp"
 
 #include "Exceptions.hpp"
+#include "BuildCache.hpp"
 #include "Context.hpp"
+#include "ExpansionCache.hpp"
+#include "InputFile.hpp"
+#include "KeyMatcher.hpp"
+#include "OutputWriter.hpp"
+#include "Stats.hpp"
+#include "TableReplacer.hpp"
+#include "TriggerScanner.hpp"
 #include "DirectReplacer.hpp"
 #include "DerivReplacer.hpp"
 #include "IntegralReplacer.hpp"
@@ -15,9 +23,108 @@
 namespace { // Ensure these variables are accessible only within this file.
 	const size_t kInputLen = strlen("\\input"); //!< Length of "\input"
 	const size_t kIncludeLen = strlen("\\include"); //!< Length of "\include"
-	std::array<const std::string, 3> extensions = {{".stex", ".sex", ".tex"}};
-	std::unordered_set<std::string> trueStrings = {{"true", "True", "TRUE", "t", "T", "y", "Y", "yes", "Yes", "1"}};
-	std::unordered_set<std::string> falseStrings = {{"false", "False", "FALSE", "f", "F", "n", "N", "no", "No", "0"}};
+	// Tables below are plain constant arrays, so they are in place before anything runs
+	// and cost nothing at startup.
+	constexpr StringView extensions[] = {".stex", ".sex", ".tex"};
+	constexpr StringView trueStrings[] = {"true", "True", "TRUE", "t", "T", "y", "Y", "yes", "Yes", "1"};
+	constexpr StringView falseStrings[] = {"false", "False", "FALSE", "f", "F", "n", "N", "no", "No", "0"};
+
+	//! Returns true if str is in the list
+	template <size_t N>
+	bool isOneOf(StringView str, const StringView (&list)[N])
+	{
+		return std::find(std::begin(list), std::end(list), str) != std::end(list);
+	}
+
+	//! Environments whose contents are copied through untouched (code, mostly), besides ctxt.rawEnvironments
+	constexpr StringView defaultRawEnvironments[] = {"verbatim", "verbatim*", "lstlisting", "minted", "comment"};
+	//! Environments whose contents are math (see Parser::readModeSwitch)
+	constexpr StringView mathEnvironments[] = {
+		"align", "align*", "alignat", "alignat*", "displaymath", "eqnarray", "eqnarray*", "equation", "equation*",
+		"flalign", "flalign*", "gather", "gather*", "math", "multline", "multline*"
+	};
+	constexpr StringView kBeginPrefix = "\\begin{";
+	constexpr StringView kEndPrefix = "\\end{";
+
+	//! Returns the length of the longest name in the list
+	template <size_t N>
+	size_t longestOf(const StringView (&list)[N])
+	{
+		size_t longest = 0;
+		for (const StringView& s : list)
+			longest = std::max(longest, s.size());
+		return longest;
+	}
+
+	//! The length of the longest \\begin{...} of a raw environment, closing brace and all
+	size_t maxRawBeginLength(const Context& ctxt)
+	{
+		size_t longest = longestOf(defaultRawEnvironments);
+		for (const std::string& env : ctxt.rawEnvironments)
+			longest = std::max(longest, env.size());
+		return kBeginPrefix.size() + longest + 1;
+	}
+
+	/*!
+	 * \brief If prefix (\\begin{ or \\end{) is at p, returns the environment name that follows it
+	 * \param maxLength Names longer than this aren't looked for (so we don't search far for the closing brace)
+	 * \returns The name, which views the source, or an empty view if there is none (or it is too long)
+	 */
+	StringView environmentNameAt(const char* p, const char* end, StringView prefix, size_t maxLength)
+	{
+		if (static_cast<size_t>(end - p) <= prefix.size() || memcmp(p, prefix.data(), prefix.size()) != 0)
+			return StringView();
+
+		const char* const nameStart = p + prefix.size();
+		const size_t searched = std::min<size_t>(end - nameStart, maxLength + 1);
+		const char* const nameEnd = static_cast<const char*>(memchr(nameStart, '}', searched));
+		return nameEnd != nullptr ? StringView(nameStart, nameEnd) : StringView();
+	}
+
+	/*!
+	 * \brief If a raw environment (see defaultRawEnvironments) begins at p, returns its name
+	 * \returns The name, which views the source, or an empty view if no raw environment begins there
+	 */
+	StringView rawEnvironmentAt(const char* p, const char* end, const Context& ctxt)
+	{
+		const StringView name = environmentNameAt(p, end, kBeginPrefix, maxRawBeginLength(ctxt) - kBeginPrefix.size() - 1);
+		if (name.empty())
+			return StringView();
+
+		const auto isName = [name](StringView env) { return env == name; };
+		if (std::none_of(std::begin(defaultRawEnvironments), std::end(defaultRawEnvironments), isName)
+		    && std::none_of(ctxt.rawEnvironments.begin(), ctxt.rawEnvironments.end(), isName))
+			return StringView();
+		return name;
+	}
+
+	/*!
+	 * \brief Finds the \\end{name} of a raw environment
+	 * \returns Where it ends (just past the closing brace), or nullptr if it doesn't end before end
+	 */
+	const char* rawEnvironmentEnd(const char* from, const char* end, StringView name)
+	{
+		// Nothing inside the environment means anything (not even a backslash), so just look for the text
+		const char* p = from;
+		while ((p = static_cast<const char*>(memmem(p, end - p, kEndPrefix.data(), kEndPrefix.size()))) != nullptr) {
+			p += kEndPrefix.size();
+			if (static_cast<size_t>(end - p) > name.size() && memcmp(p, name.data(), name.size()) == 0
+			    && p[name.size()] == '}')
+				return p + name.size() + 1;
+		}
+		return nullptr;
+	}
+
+	// Character classes for the macro option lexer
+
+	//! Whitespace inside an options list (newlines are handled separately)
+	inline bool isOptionSpace(char c) { return c == ' ' || c == '\t' || c == '\v' || c == '\f'; }
+
+	//! Characters that can appear in an option name
+	inline bool isOptionNameChar(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+
+	//! Characters that can appear in an unquoted option or flag
+	inline bool isUnquotedOptionChar(char c) { return c != '"' && c != '=' && c != ',' && c != ']'; }
 
 	namespace Replacers {
 		IntegralReplacer ir;
@@ -28,15 +135,85 @@ namespace { // Ensure these variables are accessible only within this file.
 		PiecewiseReplacer pr;
 		// TestReplacer tr;
 	}
-	std::array<Replacer*, 6> replacers = {{&Replacers::ur, &Replacers::ir, &Replacers::sr, &Replacers::dr,
-	                                       &Replacers::ar, &Replacers::pr}};
+	Replacer* const replacers[] = {&Replacers::ur, &Replacers::ir, &Replacers::sr, &Replacers::dr,
+	                               &Replacers::ar, &Replacers::pr};
+	//! The keys of every replacer that applies in running text, compiled into one automaton
+	//! (without allocating; see KeyMatcher)
+	const KeyMatcher textMatcher(std::begin(replacers), std::end(replacers), Replacer::Text);
+	//! The same for math
+	const KeyMatcher mathMatcher(std::begin(replacers), std::end(replacers), Replacer::Math);
+
+	//! Returns the automaton of keys that apply in a mode
+	inline const KeyMatcher& matcherFor(Replacer::Mode mode)
+	{
+		return mode == Replacer::Math ? mathMatcher : textMatcher;
+	}
+
+	//! Bytes that can start an include (\\), a comment (%), or a newline.
+	//! Everything else is skipped over in bulk.
+	const TriggerScanner includeTriggers("\\%\r\n");
+	//! Bytes that can start a newline, for skipping to the end of a line or over lines in bulk
+	const TriggerScanner newlineTriggers("\r\n");
+	//! Bytes that can start an include, a comment, a newline, or a switch into or out of math ($, \\[, etc.)
+	constexpr StringView kModeTriggers = "\\%\r\n$";
+
+	//! Returns kModeTriggers plus the first byte of every key in an automaton
+	TriggerScanner keyTriggersOf(const KeyMatcher& m)
+	{
+		TriggerScanner ret(kModeTriggers);
+		for (unsigned int b = 0; b < 256; ++b) {
+			if (m.startsKey(static_cast<unsigned char>(b)))
+				ret.add(static_cast<unsigned char>(b));
+		}
+		return ret;
+	}
+
+	//! The bytes to stop on when making replacements in running text.
+	//! Built-in keys are all math, so this is little more than what starts math.
+	const TriggerScanner textTriggers = keyTriggersOf(textMatcher);
+	//! The bytes to stop on when making replacements in math
+	const TriggerScanner mathTriggers = keyTriggersOf(mathMatcher);
+
+	//! How far past a trigger we might need to look to know what it starts
+	//! (the longest key, \\include, or \\begin{...} of a math environment, plus the byte after it)
+	const ptrdiff_t kMaxLookahead = std::max({mathMatcher.maxKeyLength(), textMatcher.maxKeyLength(), kIncludeLen,
+	                                          kBeginPrefix.size() + longestOf(mathEnvironments) + 1}) + 1;
+
+	//! How much to read at a time when streaming
+	const size_t kStreamChunkSize = 64 * 1024;
+
+	//! The bytes to stop on when making replacements in a mode: textTriggers or mathTriggers,
+	//! plus the first bytes of any table keys
+	const TriggerScanner& keyTriggers(const Context& ctxt, Replacer::Mode mode)
+	{
+		if (ctxt.table != nullptr)
+			return ctxt.table->triggers(mode);
+		return mode == Replacer::Math ? mathTriggers : textTriggers;
+	}
+
+	//! kMaxLookahead, allowing for any table keys and the \\begin{...} of any raw environment
+	ptrdiff_t maxLookahead(const Context& ctxt)
+	{
+		ptrdiff_t ret = std::max<ptrdiff_t>(kMaxLookahead, maxRawBeginLength(ctxt) + 1);
+		if (ctxt.table != nullptr)
+			ret = std::max<ptrdiff_t>(ret, ctxt.table->maxKeyLength() + 1);
+		return ret;
+	}
+}
+
+std::unique_ptr<TableReplacer> loadTables(const std::string& config, const std::string& image, Context& ctxt)
+{
+	std::unique_ptr<TableReplacer> ret(new TableReplacer(config, image, kModeTriggers + textMatcher.firstBytes(),
+	                                                     kModeTriggers + mathMatcher.firstBytes(), ctxt.verbose));
+	ctxt.table = ret.get();
+	return ret;
 }
 
 bool Parser::getStringTruthValue(const std::string& str)
 {
-	if (trueStrings.find(str) != trueStrings.end())
+	if (isOneOf(str, trueStrings))
 		return true;
-	else if (falseStrings.find(str) != falseStrings.end())
+	else if (isOneOf(str, falseStrings))
 		return false;
 	else
 		errorOnLine("Unknown value for boolean argument");
@@ -45,174 +222,1146 @@ bool Parser::getStringTruthValue(const std::string& str)
 	return false;
 }
 
+namespace {
+	/*!
+	 * \brief Writes out parsed text with its replacements made
+	 * \param w The writer to write with (an OutputWriter, or an OutputHasher to see what would be written)
+	 * \param from The start of the parsed text
+	 * \param to One past the end of the parsed text
+	 * \param p The parser that parsed [from, to), with its replacements
+	 * \param newline Newlines in replacements are converted to this. Source text is written as-is.
+	 */
+	template <typename Writer>
+	void writeReplaced(Writer& w, const char* from, const char* to, const Parser& p, StringView newline)
+	{
+		const std::vector<Replacement>& replacements = p.replacements;
+		const std::vector<Splice>& splices = p.splices;
+
+		// Source text can contain replacements, which can have source text spliced into them, and so on.
+		// Walk that tree with an explicit stack of what we are in the middle of writing,
+		// so nesting depth is limited only by memory.
+		struct Frame {
+			const Replacement* r; //!< The replacement being written, or nullptr if we're writing source text
+			const char* curr; //!< Where we are in the source text
+			const char* end; //!< The end of the source text
+			size_t next; //!< For source text, where to look for its next replacement. For r, its next splice.
+			size_t textAt; //!< Where we are in r's text
+		};
+
+		const bool convertNewlines = newline != "\n";
+		const auto writeText = [&](StringView text) {
+			if (convertNewlines)
+				w.writeWithNewlines(text, newline);
+			else
+				w.write(text);
+		};
+
+		const auto firstAtOrAfter = [&](size_t from, const char* p) {
+			return static_cast<size_t>(std::lower_bound(replacements.begin() + from, replacements.end(), p,
+			                                            [](const Replacement& r, const char* c) { return r.start < c; })
+			                           - replacements.begin());
+		};
+
+		std::vector<Frame> stack;
+		stack.push_back({nullptr, from, to, firstAtOrAfter(0, from), 0});
+		while (!stack.empty()) {
+			Frame& f = stack.back();
+			if (f.r == nullptr) {
+				if (f.next == replacements.size() || replacements[f.next].start >= f.end) {
+					w.write(f.curr, f.end - f.curr);
+					stack.pop_back();
+					continue;
+				}
+				// Write from the current location up to the start of the replacement, then the replacement
+				// Replacements nested inside it come right after it, and are written with its splices, so skip them.
+				const Replacement& r = replacements[f.next];
+				f.next = r.nestedEnd;
+				w.write(f.curr, r.start - f.curr);
+				f.curr = r.end;
+				if (r.numSplices == 0)
+					writeText(r.text(p.replacementText));
+				else
+					stack.push_back({&r, nullptr, nullptr, 0, 0});
+			}
+			else {
+				const StringView text = f.r->text(p.replacementText);
+				if (f.next == f.r->numSplices) {
+					writeText(StringView(text.data() + f.textAt, text.size() - f.textAt));
+					stack.pop_back();
+					continue;
+				}
+				const Splice& sp = splices[f.r->firstSplice + f.next++];
+				writeText(StringView(text.data() + f.textAt, sp.at - f.textAt));
+				f.textAt = sp.at;
+				// Replacements in the spliced text come after the one it is spliced into
+				const size_t after = f.r - replacements.data() + 1;
+				stack.push_back({nullptr, sp.source.begin(), sp.source.end(), firstAtOrAfter(after, sp.source.begin()), 0});
+			}
+		}
+	}
+
+	//! Returns true if this is a .stex or .sex file, which we will generate a LaTeX file for
+	bool isSemTeXFile(const std::string& file)
+	{
+		const auto endsWith = [&](StringView ext) {
+			return file.length() > ext.length()
+			       && file.compare(file.length() - ext.length(), ext.length(), ext.begin(), ext.length()) == 0;
+		};
+		return endsWith(extensions[0]) || endsWith(extensions[1]);
+	}
+
+	/*!
+	 * \brief Opens the LaTeX file generated from a SemTeX one for writing,
+	 *        creating its directory first if it is in ctxt.outputDir
+	 */
+	std::unique_ptr<OutputFile> openOutput(const std::string& outname, const Context& ctxt)
+	{
+		if (!ctxt.outputDir.empty()) {
+			boost::system::error_code ec; // OutputFile will complain if this didn't work
+			boost::filesystem::create_directories(boost::filesystem::path(outname).parent_path(), ec);
+		}
+		return std::unique_ptr<OutputFile>(new OutputFile(outname));
+	}
+}
+
+std::string outputName(const std::string& file, const Context& ctxt)
+{
+	// Replace the file's extension
+	static const boost::regex fext(R"regex((stex|sex)$)regex", boost::regex::optimize);
+	const std::string texname = boost::regex_replace(file, fext, "tex");
+	if (ctxt.outputDir.empty())
+		return texname;
+
+	const boost::filesystem::path p = boost::filesystem::path(texname).lexically_normal();
+	const bool escapes = p.has_root_path() || std::any_of(p.begin(), p.end(),
+	                                                      [](const boost::filesystem::path& c) { return c == ".."; });
+	return (boost::filesystem::path(ctxt.outputDir) / (escapes ? p.filename() : p)).string();
+}
+
+namespace {
+	/*!
+	 * \brief Adds a file found by \\include or \\input to the include graph,
+	 *        and processes it if it hasn't been seen before (see Parser::processInclude)
+	 * \returns false if the include would close a cycle (which is then set to the files in it)
+	 */
+	bool addInclude(const std::string& parent, const std::string& file, Context& ctxt,
+	                std::vector<std::string>& cycle)
+	{
+		switch (ctxt.includes.add(parent, file, cycle)) {
+			case IncludeGraph::Result::New:
+				if (ctxt.verbose && !ctxt.error)
+					printf("Adding %s to the list of files to be processed\n", file.c_str());
+
+				enqueueFile(file, ctxt);
+				return true;
+
+			case IncludeGraph::Result::Seen:
+				if (ctxt.verbose && !ctxt.error)
+					printf("%s has already been added to the list of files to be processed\n", file.c_str());
+				return true;
+
+			case IncludeGraph::Result::Cycle:
+			default:
+				return false;
+		}
+	}
+
+	//! Describes an include cycle found by addInclude()
+	std::string cycleMessage(const std::vector<std::string>& cycle)
+	{
+		return "\\include or \\input creates a cycle (" + boost::algorithm::join(cycle, " -> ") + ")";
+	}
+
+	/*!
+	 * \brief Prints the warnings and processes the includes in a log (see Parser::setLog), in order
+	 * \param file The file the log is from
+	 * \throws InvalidInputException if an include now closes a cycle
+	 */
+	void replayLog(const std::vector<LogEntry>& log, const std::string& file, Context& ctxt)
+	{
+		for (const LogEntry& e : log) {
+			if (!e.isInclude) {
+				printf("%s\n", e.text.c_str());
+				continue;
+			}
+			// Whoever logged the include checked it didn't close a cycle then,
+			// but another file could have included this one since.
+			std::vector<std::string> cycle;
+			if (!addInclude(file, e.text, ctxt, cycle))
+				throw Exceptions::InvalidInputException(file + ": error: " + cycleMessage(cycle), __FUNCTION__);
+		}
+	}
+
+	//! Files smaller than this are always parsed in one piece
+	const size_t kMinSplitSize = 1024 * 1024;
+	//! The smallest piece we split a file into
+	const size_t kMinSplitChunk = 256 * 1024;
+
+	//! Bytes that can open or close a group, start a comment or command, or end a line
+	const TriggerScanner splitTriggers("{}%\\\r\n");
+
+	//! An environment that a replacer takes over (such as piecewise), which can't be split
+	struct Environment {
+		std::string begin;
+		std::string end;
+	};
+
+	//! Every environment started by a replacer key.
+	//! Built the first time a file is split, rather than at startup.
+	const std::vector<Environment>& replacedEnvironments()
+	{
+		static const std::vector<Environment> ret = [] {
+			const StringView beginPrefix = "\\begin{";
+			std::vector<Environment> envs;
+			for (const Replacer* r : replacers) {
+				for (size_t k = 0; k < r->numKeys(); ++k) {
+					const StringView key = r->key(k);
+					if (key.length() >= beginPrefix.length() && StringView(key.begin(), beginPrefix.length()) == beginPrefix)
+						envs.push_back({key.str(), "\\end" + key.str().substr(strlen("\\begin"))});
+				}
+			}
+			return envs;
+		}();
+		return ret;
+	}
+
+	//! A place a file can be split, and the line that starts there
+	struct SplitPoint {
+		const char* at;
+		int line;
+	};
+
+	/*!
+	 * \brief Finds places to split a file that no macro can span, roughly every chunkSize bytes
+	 *
+	 * These are the ends of blank lines (paragraph breaks) outside of any braces, replaced environments,
+	 * or raw environments (whose contents the parser skips whole; see Parser::skipRawEnvironment).
+	 * A macro's options and arguments can't be separated from it by a blank line, so no macro
+	 * can start before one of these and end after it.
+	 * Newlines are counted just like Parser::readNewline counts them, so line numbers match the parser's.
+	 *
+	 * A wrong guess is never fatal. A macro cut off by a split fails to parse (it runs out of input),
+	 * and the file is then parsed in one piece (see parseInPieces()). That is what makes it safe to give up
+	 * on the brace count and split anyway when stray braces in ordinary text keep it from reaching zero.
+	 */
+	std::vector<SplitPoint> findSplitPoints(const char* begin, const char* end, size_t chunkSize, const Context& ctxt)
+	{
+		std::vector<SplitPoint> ret;
+		int line = 1;
+		size_t depth = 0; //!< How many braces we are inside of
+		size_t envDepth = 0; //!< How many replaced environments we are inside of
+		const char* nextSplit = begin + chunkSize;
+
+		const auto readNewline = [&](const char*& p) {
+			if (p >= end || (*p != '\n' && *p != '\r'))
+				return false;
+			if (*p == '\r')
+				p += p + 1 < end && p[1] == '\n' ? 2 : 1;
+			if (p < end && *p == '\n')
+				p += p + 1 < end && p[1] == '\r' ? 2 : 1;
+			++line;
+			return true;
+		};
+
+		const char* p = begin;
+		while ((p = splitTriggers.next(p, end)) < end) {
+			if (*p == '\n' || *p == '\r') {
+				readNewline(p);
+				// Stray braces in ordinary text could otherwise keep us from ever splitting again,
+				// so once we are well past where we wanted to split, split at the next blank line regardless.
+				const bool outside = depth == 0 && envDepth == 0;
+				if (p < nextSplit || (!outside && p < nextSplit + chunkSize))
+					continue;
+
+				// Is the next line blank?
+				const char* next = p;
+				while (next < end && (*next == ' ' || *next == '\t'))
+					++next;
+				if (readNewline(next) && next < end) {
+					ret.push_back({next, line});
+					nextSplit = next + chunkSize;
+					depth = 0;
+					envDepth = 0;
+				}
+				p = next;
+			}
+			else if (p > begin && p[-1] == '\\') {
+				++p; // Escaped
+			}
+			else if (*p == '%' && depth == 0) {
+				// Skip comments, like the parser does outside of arguments
+				p = newlineTriggers.next(p, end);
+			}
+			else if (*p == '{') {
+				++depth;
+				++p;
+			}
+			else if (*p == '}') {
+				if (depth > 0)
+					--depth;
+				++p;
+			}
+			else {
+				const char* const from = p++;
+				const StringView raw = rawEnvironmentAt(from, end, ctxt);
+				if (!raw.empty()) {
+					// Blank lines and braces mean nothing in a raw environment, so skip it whole
+					const char* const rawEnd = rawEnvironmentEnd(from, end, raw);
+					if (rawEnd == nullptr)
+						break;
+					p = newlineTriggers.next(from, rawEnd);
+					while (p < rawEnd) {
+						readNewline(p);
+						p = newlineTriggers.next(p, rawEnd);
+					}
+					p = rawEnd;
+					continue;
+				}
+				for (const auto& env : replacedEnvironments()) {
+					if (static_cast<size_t>(end - from) >= env.begin.length()
+					    && memcmp(from, env.begin.data(), env.begin.length()) == 0) {
+						++envDepth;
+						p = from + env.begin.length();
+						break;
+					}
+					if (static_cast<size_t>(end - from) >= env.end.length()
+					    && memcmp(from, env.end.data(), env.end.length()) == 0) {
+						if (envDepth > 0)
+							--envDepth;
+						p = from + env.end.length();
+						break;
+					}
+				}
+			}
+		}
+		return ret;
+	}
+
+	/*!
+	 * \brief Parses a large file in pieces, in parallel, if that is enabled and worth doing
+	 * \returns true if p now holds the results of parsing the whole file (as if p.parseLoop() had been called),
+	 *          or false if the file should be parsed in one piece instead (p is untouched)
+	 *
+	 * Each piece gets its own parser, which holds back warnings and includes.
+	 * Once every piece has been parsed, they are replayed in order and the results are merged into p,
+	 * so the output, messages, and line numbers are the same as if the file were parsed in one piece.
+	 * If any piece failed to parse, everything is thrown away so that parsing it in one piece
+	 * can report the error exactly as it would have anyway.
+	 *
+	 * If record isn't nullptr, the pieces' warnings and includes are added to it too.
+	 * If stats isn't nullptr, the pieces' replacements and recursion are timed into it.
+	 */
+	bool parseInPieces(Parser& p, const std::string& file, const char* begin, const char* end,
+	                   bool createReplacements, Context& ctxt, std::vector<LogEntry>* record, FileStats* stats)
+	{
+		const size_t size = end - begin;
+		const unsigned int workers = ctxt.pool.getNumWorkers();
+		if (!ctxt.parallelParse || workers < 2 || size < kMinSplitSize)
+			return false;
+
+		// A few pieces per worker, so that pieces that take longer than others don't leave workers idle
+		const std::vector<SplitPoint> splits = findSplitPoints(begin, end, std::max(kMinSplitChunk, size / (workers * 4)), ctxt);
+		if (splits.empty())
+			return false;
+
+		const size_t numPieces = splits.size() + 1;
+		if (ctxt.verbose && !ctxt.error)
+			printf("Parsing %s in %zu pieces...\n", file.c_str(), numPieces);
+
+		std::vector<std::unique_ptr<Parser>> pieces;
+		std::vector<std::vector<LogEntry>> logs(numPieces);
+		std::vector<FileStats> pieceStats(stats != nullptr ? numPieces : 0);
+		std::unique_ptr<std::atomic_bool[]> failed(new std::atomic_bool[numPieces]);
+		std::vector<WorkerPool::Task> tasks;
+		for (size_t i = 0; i < numPieces; ++i) {
+			const char* const from = i == 0 ? begin : splits[i - 1].at;
+			const char* const to = i == splits.size() ? end : splits[i].at;
+			pieces.emplace_back(new Parser(file, from, to, ctxt, i == 0 ? 1 : splits[i - 1].line));
+			Parser& piece = *pieces.back();
+			piece.setWindow(begin, from, to, false); // So the piece can look back past its start (for escapes)
+			piece.setLog(&logs[i]);
+			if (stats != nullptr)
+				piece.setStats(&pieceStats[i]);
+
+			std::atomic_bool& pieceFailed = failed[i];
+			pieceFailed = false;
+			tasks.push_back([&piece, &pieceFailed, createReplacements] {
+				try {
+					if (createReplacements)
+						piece.reserveReplacements();
+					piece.parseLoop(createReplacements);
+				}
+				catch (...) {
+					pieceFailed = true;
+				}
+			});
+		}
+		ctxt.pool.runAll(std::move(tasks));
+
+		for (size_t i = 0; i < numPieces; ++i) {
+			// Every piece starts out in running text, so one that ends in math (a blank line in an equation,
+			// a stray $) means the next was parsed in the wrong mode
+			if (failed[i] || (i + 1 < numPieces && pieces[i]->currentMode() != Replacer::Text)) {
+				if (ctxt.verbose && !ctxt.error)
+					printf("Could not parse %s in pieces. Parsing it in one...\n", file.c_str());
+				return false;
+			}
+		}
+
+		for (size_t i = 0; i < numPieces; ++i) {
+			replayLog(logs[i], file, ctxt);
+			if (record != nullptr)
+				record->insert(record->end(), logs[i].begin(), logs[i].end());
+			p.absorb(*pieces[i]);
+		}
+		for (const FileStats& ps : pieceStats)
+			stats->add(ps);
+		return true;
+	}
+}
+
+namespace {
+	//! True if a file exists and holds exactly size bytes, hashing to hash
+	bool fileHolds(const std::string& file, size_t size, uint64_t hash)
+	{
+		const FileStamp stamp = FileStamp::of(file);
+		if (!stamp.exists || stamp.size != size)
+			return false;
+
+		const InputFile existing(file);
+		return hashBytes(existing.data(), existing.size()) == hash;
+	}
+
+	//! True if the output in a cache entry hasn't been touched since it was written (or there isn't one)
+	bool outputUntouched(const BuildCache::Entry& e)
+	{
+		return e.output.empty() || FileStamp::of(e.output) == e.outputStamp;
+	}
+
+	//! Does what processing a file did last time, without parsing it: replays its log and keeps its output
+	void reuseCached(const std::string& file, const BuildCache::Entry& e, Context& ctxt)
+	{
+		if (ctxt.verbose && !ctxt.error)
+			printf("%s is unchanged since it was last processed. Skipping it.\n", file.c_str());
+
+		replayLog(e.log, file, ctxt);
+		if (!e.output.empty()) {
+			ctxt.generatedFilesMutex.lock();
+			ctxt.generatedFiles.emplace_back(e.output);
+			ctxt.generatedFilesMutex.unlock();
+		}
+	}
+}
+
 void processFile(const std::string& file, Context& ctxt)
 {
 	if (ctxt.verbose && !ctxt.error)
 		printf("Processing %s...\n", file.c_str());
 
-	std::ifstream inf(file, std::ifstream::binary);
-	if (!inf.good()) {
-		throw Exceptions::FileException("Error: Could not open " + file, __FUNCTION__);
+	// True if this is as .stex or .sex file and we will modify it
+	const bool createModdedCopy = isSemTeXFile(file);
+
+	// Timings and counts for --stats, added to ctxt.stats once we're done
+	FileStats fileStats;
+	FileStats* const stats = ctxt.stats != nullptr ? &fileStats : nullptr;
+
+	if (ctxt.stream) {
+		InputStream in(file);
+		std::unique_ptr<OutputFile> outfile;
+		if (createModdedCopy) {
+			outfile = openOutput(outputName(file, ctxt), ctxt);
+			ctxt.generatedFilesMutex.lock();
+			ctxt.generatedFiles.emplace_back(outfile->name());
+			ctxt.generatedFilesMutex.unlock();
+		}
+		{
+			// Reading, parsing and writing are interleaved, so they're all timed as parsing
+			PhaseTimer timer(stats, FileStats::Parse);
+			processStream(in, outfile ? outfile->fd() : -1, ctxt);
+		}
+
+		if (ctxt.verbose && !ctxt.error)
+			printf("Done processing %s...\n", file.c_str());
+		if (stats != nullptr) {
+			stats->bytesIn = FileStamp::of(file).size;
+			stats->bytesOut = outfile ? FileStamp::of(outfile->name()).size : 0;
+			ctxt.stats->addFile(file, fileStats);
+		}
+		return;
 	}
-	inf.seekg(0, std::ifstream::end);
-	size_t fileSize = inf.tellg();
-	inf.seekg(0, std::ifstream::beg);
-	std::unique_ptr<char[]> fileBuff(new char[fileSize]);
-	inf.read(fileBuff.get(), fileSize);
-	inf.close();
+
+	// With a build cache, a file that hasn't changed since it was last processed (and whose output hasn't
+	// been touched since) isn't parsed again. The source is stamped before it is read, so a change made
+	// while we read it is caught next time.
+	BuildCache::Entry cached;
+	const bool haveCached = ctxt.cache != nullptr && ctxt.cache->lookup(file, cached);
+	const FileStamp sourceStamp = ctxt.cache != nullptr ? FileStamp::of(file) : FileStamp();
+	if (haveCached && sourceStamp == cached.source && outputUntouched(cached)) {
+		reuseCached(file, cached, ctxt);
+		if (stats != nullptr) {
+			stats->cached = true;
+			stats->bytesIn = sourceStamp.size;
+			ctxt.stats->addFile(file, fileStats);
+		}
+		return;
+	}
+
+	// Map (or read) in the file. The parser and its replacements point straight into its contents.
+	PhaseTimer readTimer(stats, FileStats::Read);
+	const InputFile in(file);
+	const char* const fileBuff = in.data();
+	const size_t fileSize = in.size();
+	readTimer.stop();
 	//! \todo Convert to UTF-8 if needed
 
-	// True if this is as .stex or .sex file and we will modify it
-	bool createModdedCopy = false;
-	const auto& ste = extensions[0];
-	const auto& se = extensions[1];
-	if ((file.length() > ste.length() && file.compare(file.length() - ste.length(), ste.length(), ste) == 0)
-	    || (file.length() > se.length() && file.compare(file.length() - se.length(), se.length(), se) == 0))
-		createModdedCopy = true;
+	// The stamp didn't match (or couldn't be trusted), but the contents might still be the same.
+	uint64_t sourceHash = 0;
+	if (ctxt.cache != nullptr) {
+		sourceHash = hashBytes(fileBuff, fileSize);
+		if (haveCached && sourceHash == cached.sourceHash && outputUntouched(cached)) {
+			reuseCached(file, cached, ctxt);
+			cached.source = sourceStamp;
+			ctxt.cache->store(file, std::move(cached));
+			if (stats != nullptr) {
+				stats->cached = true;
+				stats->bytesIn = fileSize;
+				ctxt.stats->addFile(file, fileStats);
+			}
+			return;
+		}
+	}
 
-	Parser p(file, fileBuff.get(), fileBuff.get() + fileSize, ctxt);
-	p.parseLoop(createModdedCopy);
+	// Record warnings and includes for the cache, so they can be replayed when the file is skipped
+	std::vector<LogEntry> record;
+	Parser p(file, fileBuff, fileBuff + fileSize, ctxt);
+	if (ctxt.cache != nullptr)
+		p.setLog(&record, false);
+	p.setStats(stats);
+	{
+		PhaseTimer timer(stats, FileStats::Parse);
+		if (!parseInPieces(p, file, fileBuff, fileBuff + fileSize, createModdedCopy, ctxt,
+		                   ctxt.cache != nullptr ? &record : nullptr, stats)) {
+			if (createModdedCopy)
+				p.reserveReplacements();
+			p.parseLoop(createModdedCopy);
+		}
+	}
 
 	if (ctxt.verbose && !ctxt.error)
 		printf("Done processing %s...\n", file.c_str());
 
+	const std::string outname = createModdedCopy ? outputName(file, ctxt) : std::string();
 	if (createModdedCopy && !ctxt.error) { // Don't bother creating a copy if we've errored out
-		if (ctxt.verbose) // Fairly safe to skip another error check here since we just checked
-			printf("Writing out LaTeX file for %s...\n", file.c_str());
-
-		// Replace the file's extension
-		static const boost::regex fext(R"regex((stex|sex)$)regex", boost::regex::optimize);
-		const std::string outname = boost::regex_replace(file, fext, "tex");
-		std::ofstream outfile(outname);
-		if (!outfile.good()) {
-			throw Exceptions::FileException("Error: Could not open output file " + outname, __FUNCTION__);
-		}
+		PhaseTimer timer(stats, FileStats::Write);
 		ctxt.generatedFilesMutex.lock();
 		ctxt.generatedFiles.emplace_back(outname);
 		ctxt.generatedFilesMutex.unlock();
-		if (p.replacements.empty()) {
-			outfile.write(fileBuff.get(), fileSize);
+
+		// Replace all newlines in replacements with the most commonly found newline in the file.
+		const std::string mostCommonNewline = p.replacements.empty() ? std::string() : p.getMostCommonNewline();
+
+		// When building incrementally, leave the output alone if it already holds what we'd write,
+		// so LaTeX (and make) don't see it as changed.
+		bool unchanged = false;
+		if (ctxt.cache != nullptr) {
+			if (p.replacements.empty()) {
+				unchanged = fileHolds(outname, fileSize, sourceHash);
+			}
+			else {
+				OutputHasher h;
+				writeReplaced(h, fileBuff, fileBuff + fileSize, p, mostCommonNewline);
+				unchanged = fileHolds(outname, h.size(), h.value());
+			}
+		}
+
+		if (unchanged) {
+			if (ctxt.verbose)
+				printf("LaTeX file for %s is unchanged. Leaving it as is.\n", file.c_str());
 		}
 		else {
+			if (ctxt.verbose) // Fairly safe to skip another error check here since we just checked
+				printf("Writing out LaTeX file for %s...\n", file.c_str());
 
-			const char* curr = fileBuff.get();
-			const std::string mostCommonNewline = p.getMostCommonNewline();
-			for (auto& r : p.replacements) {
-				// Replace all newlines in replacements with the most commonly found newline in the file,
-				boost::replace_all(r.replaceWith, "\n", mostCommonNewline);
-				// Write from the current location up to the start of the replacement
-				outfile.write(curr, std::distance(curr, r.start));
-				// Write the replacement
-				outfile << r.replaceWith;
-				curr = r.end;
+			const std::unique_ptr<OutputFile> outfile = openOutput(outname, ctxt);
+			if (p.replacements.empty()) {
+				// Nothing changed, so let the kernel copy the file for us
+				copyFileContents(in, *outfile);
+			}
+			else {
+				OutputWriter w(outfile->fd(), outfile->name(), fileSize);
+				writeReplaced(w, fileBuff, fileBuff + fileSize, p, mostCommonNewline);
+				w.flush();
 			}
-			// Write out the end of the file
-			outfile.write(curr, std::distance(curr, p.end));
+			if (ctxt.verbose && !ctxt.error) // Fairly safe to skip another error check here since we just checked
+				printf("Done writing out LaTeX file for %s...\n", file.c_str());
+		}
+	}
+
+	if (ctxt.cache != nullptr && !ctxt.error) {
+		BuildCache::Entry e;
+		e.source = sourceStamp;
+		e.sourceHash = sourceHash;
+		if (createModdedCopy) {
+			e.output = outname;
+			e.outputStamp = FileStamp::of(outname); // Now that it's closed
+		}
+		e.log = std::move(record);
+		ctxt.cache->store(file, std::move(e));
+	}
+
+	if (stats != nullptr) {
+		stats->bytesIn = fileSize;
+		stats->bytesOut = createModdedCopy ? FileStamp::of(outname).size : 0;
+		ctxt.stats->addFile(file, fileStats);
+	}
+}
+
+void enqueueFile(const std::string& file, Context& ctxt)
+{
+	ctxt.pool.submit([file, &ctxt] {
+		// Once something has gone wrong, don't bother with the rest
+		if (ctxt.error)
+			return;
+
+		try {
+			processFile(file, ctxt);
+		}
+		catch (const Exceptions::Exception& ex) {
+			ctxt.error = true;
+			fprintf(stderr, "%s\n", ex.message.c_str());
 		}
-		if (ctxt.verbose && !ctxt.error) // Fairly safe to skip another error check here since we just checked
-			printf("Done writing out LaTeX file for %s...\n", file.c_str());
+		catch (const std::exception& ex) {
+			ctxt.error = true;
+			fprintf(stderr, "Unexpected fatal error: %s\n", ex.what());
+		}
+		catch (...) {
+			ctxt.error = true;
+			fprintf(stderr, "Unexpected fatal error");
+		}
+	});
+}
+
+void processStream(InputStream& in, int out, Context& ctxt)
+{
+	const bool createReplacements = out >= 0;
+
+	// The text we have yet to parse starts at buff[1].
+	// buff[0] holds the byte before it, so we can still tell if a % at its start is escaped.
+	std::vector<char> buff;
+	size_t unparsed = 0;
+	bool atStart = true;
+	bool moreInput = true;
+	Parser p(in.name(), nullptr, nullptr, ctxt);
+	while (moreInput) {
+		// Read another chunk. If what we are carrying over is bigger than that (one very long macro),
+		// read as much again, so that each byte of it is only parsed a few times over.
+		const size_t toRead = std::max(kStreamChunkSize, unparsed);
+		buff.resize(1 + unparsed + toRead);
+		const size_t got = in.read(buff.data() + 1 + unparsed, toRead);
+		moreInput = got == toRead;
+		unparsed += got;
+
+		const char* const first = buff.data() + 1;
+		p.setWindow(atStart ? first : buff.data(), first, first + unparsed, moreInput);
+		p.parseLoop(createReplacements);
+
+		// Everything up to where the parser stopped is final, so write it out now.
+		// Newlines in replacements are converted to the most common newline seen so far.
+		if (createReplacements) {
+			const std::string mostCommonNewline = p.getMostCommonNewline();
+			OutputWriter w(out, in.name(), p.curr - first);
+			writeReplaced(w, first, p.curr, p, mostCommonNewline);
+			w.flush();
+		}
+		p.replacements.clear();
+		p.splices.clear();
+		p.replacementText.clear();
+
+		// Carry the rest over to the next chunk
+		const size_t parsed = p.curr - first;
+		if (parsed > 0) {
+			buff[0] = first[parsed - 1];
+			atStart = false;
+		}
+		memmove(buff.data() + 1, first + parsed, unparsed - parsed);
+		unparsed -= parsed;
 	}
 }
 
 void Parser::parseLoop(bool createReplacements)
 {
-	const char* const first = curr;
+	const ptrdiff_t lookahead = maxLookahead(ctxt);
 	while (curr < end) {
-		// Characters to the end of the file
-		const size_t remaining = end - curr;
+		// Jump straight to the next byte that could matter to us (in the mode we're in).
+		// Newlines are triggers, so line and newline style counting still sees every one.
+		const TriggerScanner& triggers = createReplacements ? keyTriggers(ctxt, mode) : includeTriggers;
+		curr = triggers.next(curr, end);
+		if (curr >= end)
+			break;
 
-		// Ignore commented-out lines
-		if (curr > first && *curr == '%' && *(curr - 1) != '\\') {
-			while (curr < end && *curr != '\n' && *curr != '\r')
-				++curr;
-			readNewline();
-		}
-		// If it's not-whitespace, try to match it to an include
-		else if (isgraph(*curr) || *curr < 0 /* unicode */) {
-			//! \todo Should we do this when recursing?
-			if ((remaining > kIncludeLen && // There are enough remaining characters to be our key
-			     strncmp(curr, "\\include", kIncludeLen) == 0 && // These characters match the key
-			     (curr[kIncludeLen] == '{' || isspace(curr[kIncludeLen]))) // This is not just part of a key
-			    ||
-				(remaining > kInputLen &&
-			     strncmp(curr, "\\input", kInputLen) == 0 &&
-			     (curr[kInputLen] == '{' || isspace(curr[kInputLen]))))
-				processInclude();
-			// Otherwise try to match it to a mapping
-			else {
-				bool matched = false;
-				if (createReplacements) { // Don't bother doing search and replace for files we won't modify
-					bool shouldRecurse = false;
-					int line = currLine;
-					const char* endSearch = curr + 1;
-					// Build a string out of the current line in which to search
-					while (endSearch < end && *endSearch != ' ' && *endSearch != '\r' && *endSearch != '\n')
-						++endSearch;
-					const std::string toSearch(curr, endSearch);
-					// For each replacer, search for its keys at the start of the line
-					for (const auto& r : replacers) {
-						auto it = r->getKeys().lower_bound(toSearch);
-						if (it == r->getKeys().end())
-							continue; // Nothing matched, so continue
-						const auto itLen = it->length();
-
-						 // Don't attempt to match something that ends with characters and is followed by characters
-						 // (it might be some LaTeX command or something)
-						if (strncmp(curr, it->c_str(), itLen) == 0 &&
-						    !(isalpha(curr[itLen] && isalpha(curr[itLen - 1])))) {
-							matched = true;
-							shouldRecurse = r->shouldRecurse();
-							line = currLine;
-							r->replace(*it, *this);
-							break;
-						}
-						if (matched)
-							break;
-					}
+		if (!partialInput) {
+			parseNext(createReplacements);
+			if (!toExpand.empty())
+				expandQueued();
+			continue;
+		}
+
+		// More input follows this buffer, so stop short of anything that could be cut off by its end
+		// (a key or \include, a \r\n), and undo anything that turns out to be (an unfinished macro).
+		// It will be parsed again from the start once the rest of it has been read.
+		if (end - curr <= lookahead)
+			break;
 
-					// Recurse here. If a new replacement was made, create a ParsInfo for the replacement
-					// and scan through it. Repeat until no more replacements are found in the replacement.
-					if (matched && shouldRecurse) {
-						const std::string& toSubSearch = replacements.back().replaceWith;
-						const char* subStart = toSubSearch.c_str();
-						const char* subEnd = subStart + toSubSearch.size();
-						Parser rp(filename, subStart, subEnd, ctxt, line);
-						rp.parseLoop(true); // Recurse using our new context
-						if (!rp.replacements.empty()) {
-							std::string newRep;
-							const char* curr = subStart;
-							for (const auto& r : rp.replacements) {
-								// Write from the current location up to the start of the replacement
-								newRep.append(curr, r.start);
-								// Write the replacement
-								newRep.append(r.replaceWith);
-								curr = r.end;
-							}
-							newRep.append(curr, rp.end);
-							replacements.back().replaceWith = std::move(newRep);
-						}
+		const char* const stepStart = curr;
+		const int stepLine = currLine;
+		const int stepUnix = unixNewlines;
+		const int stepWindows = windowsNewlines;
+		const int stepMac = macNewlines;
+		const Replacer::Mode stepMode = mode;
+		const size_t stepReplacements = replacements.size();
+		const size_t stepSplices = splices.size();
+		const size_t stepText = replacementText.size();
+		ranOutOfInput = false;
+		try {
+			parseNext(createReplacements);
+			if (!toExpand.empty())
+				expandQueued();
+		}
+		catch (const Exceptions::InvalidInputException&) {
+			// Errors found after running out of input (e.g. "End of file reached...") might not be errors
+			if (!ranOutOfInput)
+				throw;
+		}
+		if (ranOutOfInput) {
+			curr = stepStart;
+			currLine = stepLine;
+			unixNewlines = stepUnix;
+			windowsNewlines = stepWindows;
+			macNewlines = stepMac;
+			mode = stepMode;
+			replacements.erase(replacements.begin() + stepReplacements, replacements.end());
+			splices.resize(stepSplices);
+			replacementText.resize(stepText);
+			ranOutOfInput = false;
+			break;
+		}
+	}
+}
+
+void Parser::reserveReplacements()
+{
+	// What an average replacement looks like, roughly
+	static const size_t kTextPerReplacement = 24;
+	static const size_t kSplicesPerReplacement = 2;
+	// How much text to count matches in. Scanning all of a big file costs about as much as the growing it saves.
+	static const ptrdiff_t kSampleSize = 64 * 1024;
+
+	const char* const sampleEnd = end - curr > kSampleSize ? curr + kSampleSize : end;
+	// Count as if it were all math, where the most keys apply
+	const TriggerScanner& triggers = keyTriggers(ctxt, Replacer::Math);
+	size_t matches = 0;
+	for (const char* p = triggers.next(curr, sampleEnd); p < sampleEnd; p = triggers.next(p + 1, sampleEnd)) {
+		if (mathMatcher.match(p, end) != nullptr || (ctxt.table != nullptr && !ctxt.table->match(p, end).empty()))
+			++matches;
+	}
+	if (sampleEnd == curr)
+		return;
+	const size_t expected = static_cast<size_t>(static_cast<double>(matches) * (end - curr) / (sampleEnd - curr));
+
+	replacements.reserve(replacements.size() + expected);
+	splices.reserve(splices.size() + expected * kSplicesPerReplacement);
+	replacementText.reserve(replacementText.size() + expected * kTextPerReplacement);
+}
+
+void Parser::parseNext(bool createReplacements)
+{
+	// Characters to the end of the file
+	const size_t remaining = end - curr;
+
+	// Ignore commented-out lines
+	if (curr > begin && *curr == '%' && *(curr - 1) != '\\') {
+		curr = newlineTriggers.next(curr, end);
+		readNewline();
+	}
+	// If it's not-whitespace, try to match it to an include
+	else if (isgraph(*curr) || *curr < 0 /* unicode */) {
+		const StringView raw = *curr == '\\' ? rawEnvironmentAt(curr, end, ctxt) : StringView();
+		if (!raw.empty())
+			skipRawEnvironment(raw);
+		// Only replacements care whether we are in math
+		else if (createReplacements && (skipInlineVerbatim() || readModeSwitch()))
+			return;
+		//! \todo Should we do this when recursing?
+		else if ((remaining > kIncludeLen && // There are enough remaining characters to be our key
+		     strncmp(curr, "\\include", kIncludeLen) == 0 && // These characters match the key
+		     (curr[kIncludeLen] == '{' || isspace(curr[kIncludeLen]))) // This is not just part of a key
+		    ||
+			(remaining > kInputLen &&
+		     strncmp(curr, "\\input", kInputLen) == 0 &&
+		     (curr[kInputLen] == '{' || isspace(curr[kInputLen]))))
+			processInclude();
+		// Otherwise try to match it to a mapping
+		else {
+			bool matched = false;
+			if (createReplacements) { // Don't bother doing search and replace for files we won't modify
+				// Find the longest key of any replacer that applies in this mode and starts here.
+				// A table key as long as a built-in one replaces it, so projects can redefine our shorthands.
+				const KeyMatcher::Entry* m = matcherFor(mode).match(curr, end);
+				KeyMatcher::Entry tableMatch = {nullptr, StringView()};
+				if (ctxt.table != nullptr && (ctxt.table->modes() & mode) != 0) {
+					const StringView key = ctxt.table->match(curr, end);
+					if (!key.empty() && (m == nullptr || key.size() >= m->key.size())) {
+						tableMatch = {ctxt.table, key};
+						m = &tableMatch;
 					}
 				}
-				if (!matched)
-					++curr; // Try again next time
+				if (m != nullptr) {
+					matched = true;
+					resetScratch(); // Nothing from the last macro is needed anymore
+					const size_t made = replacements.size();
+					if (stats != nullptr) {
+						FileStats::KeyStats& ks = stats->key(m->key);
+						++ks.matches;
+						PhaseTimer t(&ks.seconds);
+						expand(*m->owner, m->key);
+					}
+					else {
+						expand(*m->owner, m->key);
+					}
+
+					// Expand any macros in the source text spliced into the replacement.
+					// This is done by expandQueued() once we're done here, not by recursing.
+					if (m->owner->shouldRecurse() && replacements.size() > made && !ranOutOfInput)
+						queueSplices(replacements.back());
+				}
 			}
+			if (!matched)
+				++curr; // Try again next time
 		}
-		// Otherwise just chomp some whitespace
-		else {
-			while (readNewline());
-			eatWhitespace();
+	}
+	// Otherwise just chomp some whitespace
+	else {
+		while (readNewline());
+		eatWhitespace();
+	}
+}
+
+void Parser::skipRawEnvironment(StringView name)
+{
+	const char* regionEnd = rawEnvironmentEnd(curr, end, name);
+	if (regionEnd == nullptr) {
+		// If more input follows, the end might be in it. Otherwise it runs to the end of the file, like LaTeX's.
+		atEnd(end);
+		regionEnd = end;
+	}
+
+	// Count its lines as we go, just like we would have
+	while ((curr = newlineTriggers.next(curr, regionEnd)) < regionEnd)
+		readNewline();
+	curr = regionEnd;
+}
+
+bool Parser::readModeSwitch()
+{
+	// \$ is a dollar sign, and \\[ a line break (with some extra space)
+	if (curr > begin && curr[-1] == '\\')
+		return false;
+
+	if (*curr == '$') {
+		// $$ opens and closes display math just as $ does inline math
+		curr += !atEnd(curr + 1) && curr[1] == '$' ? 2 : 1;
+		mode = mode == Replacer::Math ? Replacer::Text : Replacer::Math;
+		return true;
+	}
+	if (*curr != '\\' || atEnd(curr + 1))
+		return false;
+
+	switch (curr[1]) {
+		case '[':
+		case '(':
+			mode = Replacer::Math;
+			curr += 2;
+			return true;
+		case ']':
+		case ')':
+			mode = Replacer::Text;
+			curr += 2;
+			return true;
+		default:
+			break;
+	}
+
+	const size_t longest = longestOf(mathEnvironments);
+	for (const StringView& prefix : {kBeginPrefix, kEndPrefix}) {
+		const StringView name = environmentNameAt(curr, end, prefix, longest);
+		if (!name.empty() && isOneOf(name, mathEnvironments)) {
+			mode = prefix == kBeginPrefix ? Replacer::Math : Replacer::Text;
+			curr = name.end() + 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Parser::skipInlineVerbatim()
+{
+	static const StringView verb = "\\verb";
+	if ((curr > begin && curr[-1] == '\\') || !lookingAt(verb))
+		return false;
+
+	const char* p = curr + verb.size();
+	if (!atEnd(p) && *p == '*')
+		++p;
+	// Any character but a letter or space can delimit it (\verbatim is something else)
+	if (atEnd(p) || isalpha(*p) || isspace(*p))
+		return false;
+
+	// It ends at the next delimiter, which has to be on the same line
+	const char delimiter = *p++;
+	while (!atEnd(p) && *p != delimiter && *p != '\n' && *p != '\r')
+		++p;
+	if (atEnd(p) || *p != delimiter)
+		return false; // LaTeX can't make sense of it either, so leave it be
+	curr = p + 1;
+	return true;
+}
+
+void Parser::expand(Replacer& r, StringView key)
+{
+	// Don't look up invocations in spliced text. Each is nested in another one, whose arguments were already
+	// read through, so finding where it ends and hashing it all again at every level would only cost us.
+	const char* const start = curr;
+	const size_t knownBraces = braceMatches.size();
+	const char* const invocationEnd =
+		ctxt.expansions != nullptr && r.isPure() && !expanding ? cacheableEnd(curr + key.size()) : nullptr;
+	// Unless we find the expansion, the replacer will parse the arguments (and find their braces) itself
+	const auto forgetBraces = [&] { braceMatches.erase(braceMatches.begin() + knownBraces, braceMatches.end()); };
+	if (invocationEnd == nullptr) {
+		forgetBraces();
+		r.replace(key, *this);
+		return;
+	}
+
+	const StringView invocation(start, invocationEnd);
+	if (const ExpansionCache::Expansion* e = ctxt.expansions->find(invocation)) {
+		ReplacementText text(*this);
+		size_t at = 0;
+		for (const ExpansionCache::Splice& s : e->splices) {
+			text += StringView(e->text.data() + at, s.at - at);
+			text.splice(StringView(start + s.offset, s.length));
+			at = s.at;
+		}
+		text += StringView(e->text.data() + at, e->text.size() - at);
+		curr = invocationEnd;
+		emit(start, text);
+		return;
+	}
+
+	forgetBraces();
+	const size_t before = replacements.size();
+	const size_t warned = warnings;
+	r.replace(key, *this);
+	if (curr != invocationEnd || warnings != warned || replacements.size() != before + 1 || ranOutOfInput)
+		return;
+
+	const Replacement& made = replacements.back();
+	ExpansionCache::Expansion e;
+	e.invocation = invocation.str();
+	e.text = made.text(replacementText).str();
+	for (size_t i = made.firstSplice; i < made.firstSplice + made.numSplices; ++i) {
+		const Splice& s = splices[i];
+		// Anything spliced in from outside the invocation would differ from one occurrence to the next
+		if (s.source.begin() < start || s.source.end() > invocationEnd)
+			return;
+		e.splices.push_back({static_cast<uint32_t>(s.at), static_cast<uint32_t>(s.source.begin() - start),
+		                     static_cast<uint32_t>(s.source.size())});
+	}
+	ctxt.expansions->insert(std::move(e));
+}
+
+const char* Parser::cacheableEnd(const char* p)
+{
+	// Don't look further than the longest invocation we'd cache, so this takes constant time
+	const char* const limit = end - p > static_cast<ptrdiff_t>(ExpansionCache::kMaxInvocation)
+	                          ? p + ExpansionCache::kMaxInvocation : end;
+	const auto lineEnds = [limit](const char* q) { return q >= limit || *q == '\n' || *q == '\r'; };
+
+	// Options, with the same idea of quoting as parseMacroOptions()
+	if (!lineEnds(p) && *p == '[') {
+		bool quoted = false;
+		for (++p; !lineEnds(p) && (quoted || *p != ']'); ++p) {
+			if (*p == '"')
+				quoted = !quoted;
+		}
+		if (lineEnds(p))
+			return nullptr;
+		++p;
+	}
+	else if (lineEnds(p) || *p != '{') {
+		return nullptr;
+	}
+
+	// Arguments, with the same idea of escaped braces as parseBracketArgs()
+	SmallList<const char*, 8> openBraces(&scratch);
+	openBraces.push_back(nullptr); // Each argument's own brace, which isn't one nested inside it
+	while (!lineEnds(p) && *p == '{') {
+		size_t depth = 1;
+		for (++p; depth > 0; ++p) {
+			if (lineEnds(p))
+				return nullptr;
+			if (*p == '{' && p[-1] != '\\') {
+				if (depth == openBraces.size())
+					openBraces.push_back(p);
+				else
+					openBraces[depth] = p;
+				++depth;
+			}
+			else if (*p == '}' && p[-1] != '\\') {
+				--depth;
+				if (depth > 0)
+					braceMatches.push_back({openBraces[depth], p, 0});
+			}
+		}
+	}
+	const char* const ret = p;
+
+	// parseBracketArgs() looks for another argument on this line or the next (see readToNextLineText()).
+	// Make sure it wouldn't find one, or run out of input (or our limit) looking.
+	while (p < limit && std::isblank(*p))
+		++p;
+	if (p < limit && *p == '\r')
+		p = p + 1 < limit && p[1] == '\n' ? p + 2 : p + 1;
+	if (p < limit && *p == '\n')
+		p = p + 1 < limit && p[1] == '\r' ? p + 2 : p + 1;
+	while (p < limit && std::isblank(*p))
+		++p;
+	if (p + 1 >= limit || *p == '{')
+		return nullptr;
+	return ret;
+}
+
+void Parser::absorb(Parser& next)
+{
+	const size_t replacementBase = replacements.size();
+	const size_t spliceBase = splices.size();
+	const size_t textBase = replacementText.size();
+	splices.insert(splices.end(), next.splices.begin(), next.splices.end());
+	replacementText += next.replacementText;
+	replacements.reserve(replacements.size() + next.replacements.size());
+	for (Replacement r : next.replacements) {
+		r.firstSplice += spliceBase;
+		r.textOffset += textBase;
+		r.nestedEnd += replacementBase;
+		replacements.push_back(r);
+	}
+	next.replacements.clear();
+	next.splices.clear();
+	next.replacementText.clear();
+
+	unixNewlines += next.unixNewlines;
+	windowsNewlines += next.windowsNewlines;
+	macNewlines += next.macNewlines;
+	mode = next.mode;
+	curr = next.curr;
+	currLine = next.currLine;
+}
+
+int Parser::lineAt(const char* p) const
+{
+	// Arguments are recorded in order, so find the last one starting at or before p
+	const auto after = std::upper_bound(argLines.begin(), argLines.end(), p,
+	                                    [](const char* l, const ArgLine& a) { return l < a.start; });
+	return after == argLines.begin() ? currLine : std::prev(after)->line;
+}
+
+void Parser::queueSplices(const Replacement& r)
+{
+	const size_t first = toExpand.size();
+	for (size_t i = r.firstSplice; i < r.firstSplice + r.numSplices; ++i)
+		toExpand.push_back({splices[i].source, lineAt(splices[i].source.data()), mode});
+
+	// The stack is expanded from the back, so sort the text back to front.
+	// The same text can be spliced in more than once (e.g. a mirrored bound), but only needs expanding once.
+	std::sort(toExpand.begin() + first, toExpand.end(),
+	          [](const PendingText& a, const PendingText& b) { return a.text.data() > b.text.data(); });
+	toExpand.erase(std::unique(toExpand.begin() + first, toExpand.end(),
+	                           [](const PendingText& a, const PendingText& b) { return a.text.data() == b.text.data(); }),
+	               toExpand.end());
+}
+
+void Parser::expandQueued()
+{
+	PhaseTimer timer(stats, FileStats::Recursion);
+
+	// Spliced text was already parsed through (as arguments), so put everything back where it was when we're done.
+	// It is also complete, so it can't run out of input.
+	const char* const resumeAt = curr;
+	const char* const resumeEnd = end;
+	const int resumeLine = currLine;
+	const int savedUnix = unixNewlines;
+	const int savedWindows = windowsNewlines;
+	const int savedMac = macNewlines;
+	const bool savedPartial = partialInput;
+	const Replacer::Mode savedMode = mode;
+	partialInput = false;
+	expanding = true;
+	// Everything queued was spliced into the last replacement made
+	const size_t outermost = replacements.size() - 1;
+	std::sort(braceMatches.begin(), braceMatches.end(),
+	          [](const BraceMatch& a, const BraceMatch& b) { return a.open < b.open; });
+
+	while (!toExpand.empty()) {
+		const PendingText next = toExpand.back();
+		toExpand.pop_back();
+		curr = next.text.begin();
+		end = next.text.end();
+		currLine = next.line;
+		mode = next.mode;
+		while (curr < end) {
+			curr = keyTriggers(ctxt, mode).next(curr, end);
+			if (curr >= end)
+				break;
+
+			const size_t queued = toExpand.size();
+			parseNext(true);
+			if (toExpand.size() > queued) {
+				// Expand what was just spliced in before we carry on with the rest of this text
+				toExpand.insert(toExpand.begin() + queued, {StringView(curr, end), currLine, mode});
+				break;
+			}
 		}
 	}
+
+	curr = resumeAt;
+	end = resumeEnd;
+	currLine = resumeLine;
+	unixNewlines = savedUnix;
+	windowsNewlines = savedWindows;
+	macNewlines = savedMac;
+	partialInput = savedPartial;
+	mode = savedMode;
+	expanding = false;
+
+	// Everything made in spliced text was made right after what it was spliced into, in order,
+	// so what is nested inside each replacement ends where the next replacement that starts after it does.
+	// Find that back to front, hopping over whole nested runs, so this takes time linear in their number.
+	for (size_t i = replacements.size(); i-- > outermost;) {
+		Replacement& r = replacements[i];
+		size_t next = i + 1;
+		while (next < replacements.size() && replacements[next].start < r.end)
+			next = replacements[next].nestedEnd;
+		r.nestedEnd = next;
+	}
 }
 
 bool Parser::readNewline()
 {
-	if (curr >= end)
+	if (atEnd(curr))
 		return false;
 
 	if (*curr == '\n' || *curr == '\r') {
 		if (*curr == '\r') {
-			if (curr < end - 1 && *(curr + 1) == '\n') {
+			if (!atEnd(curr + 1) && *(curr + 1) == '\n') {
 				++windowsNewlines;
 				curr +=2;
 			}
@@ -222,8 +1371,8 @@ bool Parser::readNewline()
 			}
 		}
 
-		if (*curr == '\n') {
-			if (curr < end - 1 && *(curr + 1) == '\r') {
+		if (!atEnd(curr) && *curr == '\n') {
+			if (!atEnd(curr + 1) && *(curr + 1) == '\r') {
 				// Rare, but possible
 				++windowsNewlines;
 				curr +=2;
@@ -247,8 +1396,10 @@ void Parser::processInclude()
 	// Increment curr appropriately
 	curr += isInclude ? kIncludeLen : kInputLen;
 
+	resetScratch(); // Nothing from the last macro is needed anymore
+
 	//! Get our args
-	decltype(parseBracketArgs()) args;
+	ArgList args;
 	try {
 		args = parseBracketArgs();
 	}
@@ -256,50 +1407,105 @@ void Parser::processInclude()
 		throw Exceptions::InvalidInputException(ex.message + " for \\include or \\import", __FUNCTION__);
 	}
 
+	// If the arguments might continue past the end of the buffer, we'll be back once they've all been read
+	if (ranOutOfInput)
+		return;
+
 	// We should only have one arg
-	if (args->size() != 1) {
+	if (args.size() != 1) {
 		errorOnLine("\\include and \\input only take a single argument");
 	}
 
-	const std::string& filename = (*args)[0];
+	const std::string includeName = args[0].str();
 
-	bool found = false;
+	// To LaTeX, \\input{foo} means foo.tex, which we generate from foo.stex (or foo.sex) if there is one.
+	// So only process the first of those that exists.
 	for (const auto& ext : extensions) {
-		std::string fullName = filename + ext;
+		std::string fullName = includeName + ext.str();
 		using namespace boost::filesystem;
-		if (exists(symlink_status(fullName))) {
-			if (ctxt.verbose && !ctxt.error)
-				printf("Adding %s to the list of files to be processed\n", fullName.c_str());
+		if (!exists(symlink_status(fullName)))
+			continue;
 
-			ctxt.queue.enqueue(std::move(fullName));
-			found = true;
+		std::vector<std::string> cycle;
+		if (holdingBack) {
+			// The include is added to the graph when the log is replayed. Make sure that won't fail.
+			if (ctxt.includes.findCycle(filename, fullName, cycle))
+				errorOnLine(cycleMessage(cycle));
+		}
+		else if (!addInclude(filename, fullName, ctxt, cycle)) {
+			errorOnLine(cycleMessage(cycle));
 		}
+		if (log != nullptr)
+			log->push_back({std::move(fullName), true});
+		return;
 	}
-	if (!found)
-		warningOnLine("Ignoring \\include or \\import for a file that cannot be found");
+	warningOnLine("Ignoring \\include or \\import for a file that cannot be found");
 }
 
-std::unique_ptr<MacroOptions> Parser::parseMacroOptions() {
-	// Regex for matching args
+MacroOptions Parser::parseMacroOptions() {
+	/*
+	 * A hand-written lexer for options lists. It accepts the same grammar as the regexes it replaced,
+	 * trying each token form in the same order:
+	 *
+	 * 1. A quoted, named arg, such as [ foo = "bar" ]
+	 * 2. An unquoted, named arg, such as [ foo = bar ]
+	 * 3. A quoted, unnamed arg, such as [ "myArg" ]
+	 * 4. An unquoted, unnamed arg, such as [ myArg ]
+	 * 5. A comma, separating args
+	 *
+	 * Names are letters only. Unquoted values can contain anything but quotes, equals signs, commas,
+	 * and closing brackets, and have surrounding whitespace trimmed. Quoted values can contain anything
+	 * but quotes and can't be empty. No token spans a line, and the form of each token can be picked
+	 * from its first few characters, so each one is only scanned once.
+	 */
 
-	// An unquoted, unnamed arg, such as [ myArg ]
-	static const boost::regex unquoted(R"regex(^\s*([^"=,\]]*\s*[^"=,\]\s]+)\s*(,|\])?)regex", boost::regex::optimize);
-	// A quoted, unnamed arg, such as [ "myArg" ]
-	static const boost::regex quoted(R"regex(^\s*"([^"]+)"\s*(,|\])?)regex", boost::regex::optimize);
-	// An unquoted, named arg, sugh as [ foo = bar ]
-	static const boost::regex unquotedNamed(R"regex(^\s*([a-zA-Z]+)\s*=\s*([^"=,\]]*\s*[^"=,\]\s]+)\s*(,|\])?)regex",
-	                                        boost::regex::optimize);
-	// A quoted, named arg, sugh as [ foo = "bar" ]
-	static const boost::regex quotedNamed(R"regex(^\s*([a-zA-Z]+)\s*=\s*"([^"]+)"\s*(,|\])?)regex",
-	                                      boost::regex::optimize);
-	// A comma, separating args
-	static const boost::regex spacedComma(R"regex(^\s*,\s*)regex", boost::regex::optimize);
+	// True if p has not hit the end of the current line
+	const auto inLine = [this](const char* p) { return !atEnd(p) && *p != '\r' && *p != '\n'; };
 
-	std::unique_ptr<MacroOptions> ret(new MacroOptions);
+	const auto skipSpace = [&](const char* p) {
+		while (inLine(p) && isOptionSpace(*p))
+			++p;
+		return p;
+	};
+
+	// Reads an unquoted value starting at p (which should not be whitespace).
+	// On success, valEnd is set past its last non-whitespace character and p is moved past the value.
+	const auto readUnquoted = [&](const char*& p, const char*& valEnd) {
+		if (!inLine(p) || !isUnquotedOptionChar(*p))
+			return false;
+
+		while (inLine(p) && isUnquotedOptionChar(*p)) {
+			if (!isOptionSpace(*p))
+				valEnd = p + 1;
+			++p;
+		}
+		return true;
+	};
+
+	// Reads a quoted value starting at p.
+	// On success, [valStart, valEnd) is set to the value and p is moved past the closing quote.
+	const auto readQuoted = [&](const char*& p, const char*& valStart, const char*& valEnd) {
+		if (!inLine(p) || *p != '"')
+			return false;
+
+		const char* close = p + 1;
+		while (inLine(close) && *close != '"')
+			++close;
+
+		if (!inLine(close) || close == p + 1)
+			return false;
+
+		valStart = p + 1;
+		valEnd = close;
+		p = close + 1;
+		return true;
+	};
+
+	MacroOptions ret(&scratch);
 
 	readToNextLineText();
 
-	if (curr >= end)
+	if (atEnd(curr))
 		errorOnLine("End of file reached before finding arguments");
 
 	if (*curr != '[')
@@ -316,86 +1522,75 @@ std::unique_ptr<MacroOptions> Parser::parseMacroOptions() {
 		if (readNewline())
 			errorOnLine("A new paragraph was found in the middle of the options list");
 
-		// Prepare the string to pass to regex (the current line)
-		const char* argEnd = curr + 1;
-		while(argEnd <= end && *argEnd != '\r' && *argEnd != '\n')
-			++argEnd;
-
-		boost::cmatch argMatch;
-		if (!needsCommaNext && boost::regex_search(curr, argEnd, argMatch, quotedNamed)) {
-			std::string newArgName(argMatch[1].first, argMatch[1].second);
-			// Make sure this option doesn't already exist
-			if (ret->opts.find(newArgName) != ret->opts.end())
-				errorOnLine("Duplicate option");
-
-			ret->opts[newArgName] = std::string(argMatch[2].first, argMatch[2].second);
-			curr = argMatch[0].second;
-			if (argMatch[3].matched) {
-				if (*argMatch[3].first == ']')
-					break;
-				lastTokenWasComma = *argMatch[3].first == ',';
-			}
-			else {
-				lastTokenWasComma = false;
-			}
-			needsCommaNext = !lastTokenWasComma;
-		}
-		else if (!needsCommaNext && boost::regex_search(curr, argEnd, argMatch, unquotedNamed)) {
-			std::string newArgName(argMatch[1].first, argMatch[1].second);
-			// Make sure this option doesn't already exist
-			if (ret->opts.find(newArgName) != ret->opts.end())
-				errorOnLine("Duplicate option");
+		if (atEnd(curr))
+			errorOnLine("End of file reached before finding the end of the options list");
 
-			ret->opts[newArgName] = std::string(argMatch[2].first, argMatch[2].second);
-			curr = argMatch[0].second;
-			if (argMatch[3].matched) {
-				if (*argMatch[3].first == ']')
-					break;
-				lastTokenWasComma = *argMatch[3].first == ',';
+		const char* const tokStart = skipSpace(curr);
+		const char* tokEnd = nullptr; // Set once we have read an option or flag
+		const char* nameStart = nullptr;
+		const char* nameEnd = nullptr;
+		const char* valStart = nullptr;
+		const char* valEnd = nullptr;
+
+		if (!needsCommaNext) {
+			// Named options (forms 1 and 2)
+			if (inLine(tokStart) && isOptionNameChar(*tokStart)) {
+				const char* p = tokStart;
+				while (inLine(p) && isOptionNameChar(*p))
+					++p;
+				nameStart = tokStart;
+				nameEnd = p;
+
+				p = skipSpace(p);
+				if (inLine(p) && *p == '=') {
+					p = skipSpace(p + 1);
+					valStart = p;
+					if (readQuoted(p, valStart, valEnd) || readUnquoted(p, valEnd))
+						tokEnd = p;
+				}
 			}
-			else {
-				lastTokenWasComma = false;
+
+			// Flags (forms 3 and 4)
+			if (tokEnd == nullptr) {
+				nameStart = nameEnd = nullptr;
+				const char* p = tokStart;
+				valStart = p;
+				if (readQuoted(p, valStart, valEnd) || readUnquoted(p, valEnd))
+					tokEnd = p;
 			}
-			needsCommaNext = !lastTokenWasComma;
 		}
-		else if(!needsCommaNext && boost::regex_search(curr, argEnd, argMatch, quoted)) {
-			std::string flag(argMatch[1].first, argMatch[1].second);
-			// Make sure this option doesn't already exist
-			if (ret->flags.find(flag) != ret->flags.end())
-				errorOnLine("Duplicate flag");
 
-			ret->flags.insert(std::move(flag));
-			curr = argMatch[0].second;
-			if (argMatch[2].matched) {
-				if (*argMatch[2].first == ']')
-					break;
-				lastTokenWasComma = *argMatch[2].first == ',';
+		if (tokEnd != nullptr) {
+			const StringView value(valStart, valEnd);
+			if (nameStart != nullptr) {
+				const StringView newArgName(nameStart, nameEnd);
+				// Make sure this option doesn't already exist
+				if (ret.getOption(newArgName) != nullptr)
+					errorOnLine("Duplicate option");
+
+				ret.opts.push_back({newArgName, value});
 			}
 			else {
-				lastTokenWasComma = false;
-			}
-			needsCommaNext = !lastTokenWasComma;
-		}
-		else if (!needsCommaNext && boost::regex_search(curr, argEnd, argMatch, unquoted)) {
-			std::string flag(argMatch[1].first, argMatch[1].second);
-			// Make sure this option doesn't already exist
-			if (ret->flags.find(flag) != ret->flags.end())
-				errorOnLine("Duplicate flag");
+				// Make sure this flag doesn't already exist
+				if (ret.hasFlag(value))
+					errorOnLine("Duplicate flag");
 
-			ret->flags.insert(std::move(flag));
-			curr = argMatch[0].second;
+				ret.flags.push_back(value);
+			}
 
-			if (argMatch[2].matched) {
-				if (*argMatch[2].first == ']')
+			// Each option can be followed by a comma or the closing bracket on the same line
+			curr = skipSpace(tokEnd);
+			if (inLine(curr) && (*curr == ',' || *curr == ']')) {
+				if (*curr++ == ']')
 					break;
-				lastTokenWasComma = *argMatch[2].first == ',';
+				lastTokenWasComma = true;
 			}
 			else {
 				lastTokenWasComma = false;
 			}
 			needsCommaNext = !lastTokenWasComma;
 		}
-		else if (boost::regex_search(curr, argEnd, argMatch, spacedComma)) {
+		else if (inLine(tokStart) && *tokStart == ',') {
 			/*
 			 * Allow for stupid crap like:
 			 * "myArg
@@ -405,53 +1600,96 @@ std::unique_ptr<MacroOptions> Parser::parseMacroOptions() {
 			if (lastTokenWasComma)
 				errorOnLine("Missing option (double commas)");
 
-			curr = argMatch[0].second;
+			curr = skipSpace(tokStart + 1);
 			lastTokenWasComma = true;
 			needsCommaNext = false;
 		}
 		else {
 			errorOnLine("Invalid option");
 		}
-
 	}
 
 	return ret;
 }
 
-std::unique_ptr<std::vector<std::string>> Parser::parseBracketArgs()
+ArgList Parser::parseBracketArgs()
 {
-	std::unique_ptr<std::vector<std::string>> ret(new std::vector<std::string>);
+	ArgList ret(&scratch);
 
+	// Where the last argument ended. Whatever we read past it while looking for another one
+	// (whitespace and maybe a newline) is given back at the end, so it is counted only once.
 	const char* argsEnd = curr;
+	int argsEndLine = currLine;
+	int argsEndUnix = unixNewlines;
+	int argsEndWindows = windowsNewlines;
+	int argsEndMac = macNewlines;
+	const auto markArgsEnd = [&] {
+		argsEnd = curr;
+		argsEndLine = currLine;
+		argsEndUnix = unixNewlines;
+		argsEndWindows = windowsNewlines;
+		argsEndMac = macNewlines;
+	};
 	while (true) {
 		readToNextLineText();
 
-		if (curr >= end || *curr != '{')
+		if (atEnd(curr) || *curr != '{')
 			break;
 
 		const char* argStart = ++curr; // Advance to the first character of the argument (after the '{')
-		int braceLevel = 1;
+		argLines.push_back({argStart, currLine});
 
-		while (braceLevel > 0) {
-			if (curr >= end)
+		if (expanding) {
+			// We already read through this argument when reading the arguments of the macro it is nested in
+			const auto known = std::lower_bound(braceMatches.begin(), braceMatches.end(), argStart - 1,
+			                                    [](const BraceMatch& m, const char* o) { return m.open < o; });
+			if (known != braceMatches.end() && known->open == argStart - 1) {
+				curr = known->close + 1;
+				currLine += known->lines;
+				ret.push_back(StringView(argStart, known->close));
+				markArgsEnd();
+				continue;
+			}
+		}
+
+		// Where each brace we're inside of is, and the line it's on
+		SmallList<ArgLine, 8> openBraces(&scratch);
+		openBraces.push_back({argStart - 1, currLine});
+		size_t depth = 1;
+		while (depth > 0) {
+			if (atEnd(curr))
 				errorOnLine("End of file reached before finding end of argument");
 
 			if (*curr == '\r' || *curr == '\n') {
 				readNewline();
 			}
 			else {
-				if (*curr == '{' && *(curr - 1) != '\\')
-					++braceLevel;
-				else if (*curr == '}' && *(curr - 1) != '\\')
-					--braceLevel;
+				if (*curr == '{' && *(curr - 1) != '\\') {
+					if (depth == openBraces.size())
+						openBraces.push_back({curr, currLine});
+					else
+						openBraces[depth] = {curr, currLine};
+					++depth;
+				}
+				else if (*curr == '}' && *(curr - 1) != '\\') {
+					--depth;
+					// Remember where each pair of braces inside the argument is,
+					// in case we expand macros in this argument later
+					if (depth > 0 && !expanding)
+						braceMatches.push_back({openBraces[depth].start, curr, currLine - openBraces[depth].line});
+				}
 
 				++curr;
 			}
 		}
-		ret->emplace_back(argStart, curr - 1);
-		argsEnd = curr;
+		ret.push_back(StringView(argStart, curr - 1));
+		markArgsEnd();
 	}
 	curr = argsEnd;
+	currLine = argsEndLine;
+	unixNewlines = argsEndUnix;
+	windowsNewlines = argsEndWindows;
+	macNewlines = argsEndMac;
 	return ret;
 }
 
@@ -473,9 +1711,18 @@ void Parser::errorOnLine(const std::string& msg) const
 		throw Exceptions::InvalidInputException(err.str(), __FUNCTION__);
 }
 
-void Parser::warningOnLine(const std::string& msg) const
+void Parser::warningOnLine(const std::string& msg)
 {
+		++warnings;
+
+		// Whatever we were parsing will be parsed again once more input has been read, so warn then
+		if (ranOutOfInput)
+			return;
+
 		std::stringstream err;
 		err << filename << ":" << currLine << ": warning: " << msg;
-		printf("%s\n", err.str().c_str());
+		if (!holdingBack)
+			printf("%s\n", err.str().c_str());
+		if (log != nullptr)
+			log->push_back({err.str(), false});
 }
@@ -1,51 +1,248 @@
 #ifndef __FILE_PARSER_HPP__
 #define __FILE_PARSER_HPP__
 
+#include "Arena.hpp"
+#include "Replacer.hpp"
+#include "SmallList.hpp"
+#include "StringView.hpp"
+
 class Context;
+class InputStream;
+struct FileStats;
+class TableReplacer;
+
+/*!
+ * \brief Source text (usually a macro argument) to be inserted into a replacement's text
+ *
+ * The source text is not copied. It is written out straight from the buffer being parsed,
+ * with any replacements made inside it, when the replacement is.
+ */
+struct Splice {
+	size_t at; //!< Where in the replacement's text the source text goes
+	StringView source; //!< The source text
+
+	Splice() : at(0), source() { }
+	Splice(size_t at, StringView source) : at(at), source(source) { }
+};
+
+class Parser;
+
+/*!
+ * \brief Emits the text of a replacement straight into the parser's replacement text,
+ *        as literal text and splices of source text
+ *
+ * Replacers that expand macros in their arguments (see Replacer::shouldRecurse) splice arguments in
+ * instead of appending them, so that nested macros are parsed once, in place, and each byte of
+ * the output is only copied when it is written, however deep the nesting.
+ *
+ * Only one replacement can be emitted at a time. Finish it with Parser::emit() before starting another.
+ */
+class ReplacementText {
+public:
+	//! Constructor. Starts the replacement at the end of the parser's replacement text.
+	explicit ReplacementText(Parser& p);
+
+	//! Appends literal text
+	ReplacementText& operator+=(StringView s)
+	{
+		text.append(s.data(), s.size());
+		return *this;
+	}
+
+	//! Appends source text
+	void splice(StringView source) { splices.push_back({text.size() - firstChar, source}); }
+
+private:
+	friend class Parser;
+
+	std::string& text; //!< The parser's replacement text, which we append to
+	std::vector<Splice>& splices; //!< Where splices are stored
+	const size_t firstChar; //!< Where our text starts in text
+	const size_t firstSplice; //!< Index of our first splice in splices
+};
 
-//! Contains the location of where to insert a replacement, and where to put it
+/*!
+ * \brief Contains the location of where to insert a replacement, and where to put it
+ *
+ * The replacement's text is kept with every other replacement's, in Parser::replacementText,
+ * so making a replacement doesn't allocate (once that and Parser::replacements have grown).
+ */
 struct Replacement {
-	const char* start = nullptr; //!< Where to start the replacement
-	const char* end = nullptr; //!< One byte past the end of the string to be replaced
-	std::string replaceWith; //!< Immutable replacement string
+	const char* start; //!< Where to start the replacement
+	const char* end; //!< One byte past the end of the string to be replaced
+	size_t textOffset; //!< Where the replacement's text (less any splices) starts in Parser::replacementText
+	size_t firstSplice; //!< Index of the first source text to insert into the text in Parser::splices
+	uint32_t textLength; //!< The length of the replacement's text
+	uint32_t numSplices;
+	size_t nestedEnd; //!< Index in Parser::replacements just past those made in source text spliced into this one
 
-	Replacement(const char* s, const char* e, std::string&& r)
-		: start(s), end(e), replaceWith(std::forward<std::string>(r))
-	{ }
+	//! Returns the replacement's text, given Parser::replacementText
+	StringView text(const std::string& replacementText) const
+	{
+		return StringView(replacementText.data() + textOffset, textLength);
+	}
+};
 
-	Replacement(const char* s, const char* e, const std::string& r)
-		: start(s), end(e), replaceWith(r)
-	{ }
+//! A named macro option (e.g. [name=value])
+struct MacroOption {
+	StringView name;
+	StringView value;
 
-	// Satisfies Effective C++ guidelines of providing copy and assignment for objects with pointers
-	Replacement& operator=(const Replacement&) = default;
-	Replacement(Replacement&) = default;
-	Replacement(Replacement&&) = default;
+	MacroOption() : name(), value() { }
+	MacroOption(StringView name, StringView value) : name(name), value(value) { }
 };
 
-//! Returned from parseArgs
+/*!
+ * \brief Returned from Parser::parseMacroOptions
+ *
+ * All names, values and flags are views into the buffer being parsed, and any lists too long to be
+ * stored inline live in the parser's arena, so these are only valid until the parser moves on to
+ * the next macro.
+ */
 struct MacroOptions {
-	std::unordered_set<std::string> flags;
-	std::unordered_map<std::string, std::string> opts;
+	SmallList<StringView, 4> flags;
+	SmallList<MacroOption, 4> opts;
+
+	explicit MacroOptions(Arena* a = nullptr) : flags(a), opts(a) { }
+
+	//! Returns true if the given flag was provided
+	bool hasFlag(StringView flag) const
+	{
+		return std::find(flags.begin(), flags.end(), flag) != flags.end();
+	}
 
-	// This has a constructor, as it is not a POD type
-	MacroOptions() : flags(), opts() { }
+	//! Returns the value of the given option, or nullptr if it was not provided
+	const StringView* getOption(StringView name) const
+	{
+		for (const auto& o : opts) {
+			if (o.name == name)
+				return &o.value;
+		}
+		return nullptr;
+	}
+};
+
+//! Returned from Parser::parseBracketArgs. Has the same lifetime as MacroOptions
+typedef SmallList<StringView, 4> ArgList;
+
+//! A warning or include found by a parser that is holding them back (see Parser::setLog)
+struct LogEntry {
+	std::string text; //!< The warning to print, or the file to process
+	bool isInclude; //!< True if text is an included file
 };
 
 class Parser {
 
 public:
 	// No need for encapsulation since nearly everything that interacts with Parser modifies these members
-	//! \todo Would a linked list run faster?
+	//! Replacements made so far, sorted by start.
+	//! Replacements made inside spliced source text come right after the replacement they are spliced into.
 	std::vector<Replacement> replacements;
-	const char* const end;
+	std::vector<Splice> splices; //!< Source text spliced into replacements, in order
+	std::string replacementText; //!< The text of every replacement, back to back (see Replacement)
+	const char* end;
 	const char* curr;
 
 	Parser(const std::string& file, const char* current, const char* end, Context& context, int startingLine = 1)
-		: replacements(), end(end), curr(current), filename(file), currLine(startingLine),
-		  unixNewlines(0), windowsNewlines(0), macNewlines(0), ctxt(context)
+		: replacements(), splices(), replacementText(), end(end), curr(current), filename(file), begin(current),
+		  currLine(startingLine), unixNewlines(0), windowsNewlines(0), macNewlines(0), mode(Replacer::Text), ctxt(context),
+		  scratch(), argLines(&scratch),
+		  toExpand(), expanding(false), braceMatches(), partialInput(false), ranOutOfInput(false), log(nullptr),
+		  holdingBack(false), stats(nullptr), warnings(0)
 	{ }
 
+	/*!
+	 * \brief Points the parser at a new window of its input. Used when streaming a file in chunks.
+	 * \param newBegin The start of the buffer. Bytes between it and newCurr are only looked back at
+	 *                 (to see if a % is escaped).
+	 * \param newCurr Where to pick up parsing
+	 * \param newEnd One past the last byte of input we have so far
+	 * \param moreInput True if more input follows newEnd.
+	 *                  parseLoop() then stops before anything that might run past newEnd.
+	 */
+	void setWindow(const char* newBegin, const char* newCurr, const char* newEnd, bool moreInput)
+	{
+		begin = newBegin;
+		curr = newCurr;
+		end = newEnd;
+		partialInput = moreInput;
+	}
+
+	/*!
+	 * \brief Adds warnings and includes to the given log as they are found
+	 * \param l The log, or nullptr to stop logging
+	 * \param holdBack True to only log them, instead of also printing and processing them right away.
+	 *                 Used when parsing pieces of a file in parallel, so that they can be replayed in order.
+	 */
+	void setLog(std::vector<LogEntry>* l, bool holdBack = true)
+	{
+		log = l;
+		holdingBack = l != nullptr && holdBack;
+	}
+
+	/*!
+	 * \brief Replaces [start, curr) with the text emitted so far
+	 * \param r The emitter. It is finished with and can't be appended to after this.
+	 */
+	void emit(const char* start, const ReplacementText& r)
+	{
+		replacements.push_back({start, curr, r.firstChar, r.firstSplice,
+		                        static_cast<uint32_t>(replacementText.size() - r.firstChar),
+		                        static_cast<uint32_t>(splices.size() - r.firstSplice),
+		                        replacements.size() + 1}); // Any nested in it are made later (see expandQueued())
+	}
+
+	//! Replaces [start, curr) with the given text
+	void emit(const char* start, StringView text)
+	{
+		ReplacementText r(*this);
+		r += text;
+		emit(start, r);
+	}
+
+	/*!
+	 * \brief Makes room for the replacements we expect to make in [curr, end)
+	 *
+	 * Counts the places a key matches in (up to) the first 64 KiB of the text and assumes the rest is alike,
+	 * so that replacements and their text aren't grown over and over as we parse.
+	 */
+	void reserveReplacements();
+
+	//! Times replacements and recursion into the given stats (see --stats), or nullptr to stop
+	void setStats(FileStats* s) { stats = s; }
+
+	/*!
+	 * \brief Takes on the results of a parser that parsed the text right after ours
+	 *
+	 * Its replacements (and their splices) are moved onto the end of ours, its newline counts are added
+	 * to ours, and we pick up where it left off.
+	 */
+	void absorb(Parser& next);
+
+	//! Returns whether we are in running text or math at curr
+	Replacer::Mode currentMode() const { return mode; }
+
+	//! Returns true if p has hit the end of the buffer.
+	//! If more input follows the buffer, this also notes that whatever we are parsing ran out of input.
+	bool atEnd(const char* p)
+	{
+		if (p < end)
+			return false;
+		if (partialInput)
+			ranOutOfInput = true;
+		return true;
+	}
+
+	//! Returns true if the text at curr starts with s
+	bool lookingAt(StringView s)
+	{
+		if (end - curr < static_cast<ptrdiff_t>(s.size())) {
+			atEnd(end);
+			return false;
+		}
+		return memcmp(curr, s.data(), s.size()) == 0;
+	}
+
 	/*!
 	 * \brief Used to parse a true or false value (usually from an argument)
 	 * \param str The string to examine
@@ -55,13 +252,19 @@ public:
 	 */
 	bool getStringTruthValue(const std::string& str);
 
-	//! The loop that pareses through an entire character sequence specified by the provided Parser
+	/*!
+	 * \brief The loop that pareses through an entire character sequence specified by the provided Parser
+	 *
+	 * If more input follows the buffer (see setWindow()), the loop stops early, leaving curr at the
+	 * first byte that could not be parsed without seeing more input.
+	 * Everything before it is final and nothing after it has been replaced.
+	 */
 	void parseLoop(bool createReplacements);
 
 	//! Reads tabs and spaces until a non-whitespace character or a newline is hit
 	void eatWhitespace()
 	{
-		while (curr < end && std::isblank(*curr))
+		while (!atEnd(curr) && std::isblank(*curr))
 			++curr;
 	}
 
@@ -90,21 +293,19 @@ public:
 
 	/*!
 	 * \brief Parses SemTeX macro options (e.g. \\macro[these]{not, these}).
-	 * \returns A heap-allocated MacroArgs struct containing the options and flags
-	 * \todo Would stack allocation be better?
+	 * \returns The options and flags, as views into the buffer being parsed
 	 *
 	 * When the function returns, curr is moved past the options section
 	 */
-	std::unique_ptr<MacroOptions> parseMacroOptions();
+	MacroOptions parseMacroOptions();
 
 	/*!
 	 * \brief Parses SemTeX arguments (e.g. \\macro[not these]{but, these}).
-	 * \returns A heap-allocated vector containing the arguments
-	 * \todo Would stack allocation be better?
+	 * \returns The arguments, as views into the buffer being parsed
 	 *
 	 * When the function returns, curr is moved past the arguments
 	 */
-	std::unique_ptr<std::vector<std::string>> parseBracketArgs();
+	ArgList parseBracketArgs();
 
 	//! Returns the most commonly used newline type in the file being parsed.
 	std::string getMostCommonNewline() const;
@@ -120,7 +321,7 @@ public:
 	 * \brief A method for printing standardized warnings for input issues
 	 * \param msg The warning-specific message to print after the file and line number
 	 */
-	void warningOnLine(const std::string& msg) const;
+	void warningOnLine(const std::string& msg);
 
 	// No copy or assignment
 	Parser(const Parser&) = delete;
@@ -128,19 +329,181 @@ public:
 
 private:
 	const std::string filename; //!< Name of the file being parsed
+	const char* begin; //!< Start of the buffer being parsed
 	int currLine; //!< Current line as the parser progresses
 	int unixNewlines; //!< Number of Unix newlines found in the file
 	int windowsNewlines; //!< Number of Windows newlines found in the file
 	int macNewlines; //!< Number of Mac newlines found in the file
+	Replacer::Mode mode; //!< Whether we are in running text or math. Only tracked when making replacements.
 	Context& ctxt; //!< Global context (error state, etc.)
+	Arena scratch; //!< Backs macro options and argument lists. Reset before each macro.
+	//! Where an argument starts, and the line it is on
+	struct ArgLine {
+		const char* start;
+		int line;
+	};
+
+	//! Every argument of the current macro, in order. Reset before each macro.
+	SmallList<ArgLine, 4> argLines;
+
+	//! Source text spliced into a replacement, which we have yet to look for macros in
+	struct PendingText {
+		StringView text;
+		int line; //!< The line text starts on
+		Replacer::Mode mode; //!< The mode text starts in
+	};
+
+	//! Spliced text to expand macros in, as a stack (the next to be expanded is at the back)
+	std::vector<PendingText> toExpand;
+	bool expanding; //!< True while expandQueued() is running
+
+	//! A matched pair of braces
+	struct BraceMatch {
+		const char* open;
+		const char* close;
+		int lines; //!< Number of newlines between them
+	};
+
+	/*!
+	 * Every pair of braces nested inside the arguments of the last macro (outside of spliced text).
+	 * When macros nested in spliced text are expanded, their arguments are looked up here
+	 * instead of being read through again, which would take time quadratic in the nesting depth.
+	 * Sorted by open when expanding.
+	 */
+	std::vector<BraceMatch> braceMatches;
+	bool partialInput; //!< True if more input follows end (we are streaming and this is not the last chunk)
+	bool ranOutOfInput; //!< Set when partialInput is true and something we were parsing hit end
+	std::vector<LogEntry>* log; //!< Where warnings and includes are logged, or nullptr (see setLog())
+	bool holdingBack; //!< True if warnings and includes are only logged
+	FileStats* stats; //!< Where to time replacements and recursion, or nullptr (see setStats())
+	size_t warnings; //!< How many warnings have been issued
+
+	/*!
+	 * \brief Has a replacer replace the invocation at curr, going through ctxt.expansions if it is pure
+	 * \param r The replacer
+	 * \param key The key that matched at curr
+	 */
+	void expand(Replacer& r, StringView key);
+
+	/*!
+	 * \brief Finds the end of the options and arguments starting at p, if they can be cached
+	 * \returns Where they end, or nullptr if they span lines, run to the end of the buffer,
+	 *          don't follow the key immediately, or are too long to cache (see ExpansionCache::kMaxInvocation)
+	 *
+	 * This is a quick scan, not a parse. The cache only takes an expansion whose parse ended exactly here,
+	 * and checks that nothing past here could have changed it.
+	 * Like parseBracketArgs(), it adds the braces nested inside the arguments to braceMatches,
+	 * so macros in them can still be expanded quickly if the expansion is found and nothing parses them.
+	 */
+	const char* cacheableEnd(const char* p);
+
+	/*!
+	 * \brief Skips over a raw environment (verbatim, lstlisting, etc.) starting at curr
+	 * \param name The environment's name
+	 *
+	 * Nothing in it is replaced, so it is copied through untouched.
+	 * When the function returns, curr is moved past its \\end (or to end if it has none)
+	 */
+	void skipRawEnvironment(StringView name);
+
+	/*!
+	 * \brief Switches between text and math if curr is at a math delimiter
+	 *        ($, $$, \\[, \\], \\(, \\), or the \\begin or \\end of an equation, align, etc. environment)
+	 * \returns true if it was one, in which case curr is moved past it
+	 *
+	 * Math is recognized by its delimiters alone, so \\text{...} and the like inside math still count as math.
+	 * The delimiters aren't checked for balance: a stray $ flips the mode until the next one.
+	 */
+	bool readModeSwitch();
+
+	/*!
+	 * \brief Skips over inline verbatim (\\verb|...|, \\verb*|...|) if curr is at it
+	 * \returns true if it was, in which case curr is moved past it
+	 *
+	 * Like a raw environment, it is copied through untouched, and a $ in it doesn't start math.
+	 */
+	bool skipInlineVerbatim();
+
+	//! Parses whatever is at curr (a comment, include, macro, newline, etc.)
+	void parseNext(bool createReplacements);
+
+	//! Resets the per-macro scratch space (options, arguments, and their lines)
+	void resetScratch()
+	{
+		scratch.reset();
+		argLines = SmallList<ArgLine, 4>(&scratch);
+		if (!expanding)
+			braceMatches.clear();
+	}
+
+	//! Returns the line the given location (in one of the current macro's arguments) is on
+	int lineAt(const char* p) const;
+
+	//! Queues up the source text spliced into a replacement to be expanded by expandQueued()
+	void queueSplices(const Replacement& r);
+
+	/*!
+	 * \brief Expands macros in queued spliced text, and in text spliced into their replacements, and so on
+	 *
+	 * Uses an explicit stack instead of recursion, so nesting depth is limited only by memory.
+	 * Each piece of spliced text is finished (including anything spliced out of it) before moving on
+	 * to the next, so replacements stays sorted.
+	 */
+	void expandQueued();
 };
 
+inline ReplacementText::ReplacementText(Parser& p)
+	: text(p.replacementText), splices(p.splices), firstChar(p.replacementText.size()), firstSplice(p.splices.size())
+{ }
+
+/*!
+ * \brief Returns the name of the LaTeX file generated from a SemTeX one
+ *
+ * That's the SemTeX file with a .tex extension, in ctxt.outputDir if one is set.
+ * There, it keeps its path relative to the current directory (where LaTeX looks for it),
+ * unless that would take it out of ctxt.outputDir, in which case it goes straight in ctxt.outputDir.
+ */
+std::string outputName(const std::string& filename, const Context& ctxt);
+
 /*!
  * \brief Processes a SemTeX file, generating a corresponding LaTeX file and adding included SemTeX files
- *        to the queue
+ *        to the pool (see enqueueFile())
  * \param filename The path of the SemTeX file to process
- * \param ctxt The global context (verbosity level, queues, etc.)
+ * \param ctxt The global context (verbosity level, pool, etc.)
  */
 void processFile(const std::string& filename, Context& ctxt);
 
+/*!
+ * \brief Submits a file to the context's pool to be processed with processFile()
+ *
+ * Errors are printed and raise ctxt.error instead of being thrown,
+ * and files still waiting to be processed once ctxt.error is raised are skipped.
+ * Call ctxt.pool.run() to process everything submitted.
+ */
+void enqueueFile(const std::string& filename, Context& ctxt);
+
+/*!
+ * \brief Loads the replacement tables in a config file and has files processed with ctxt use them too
+ * \param config The config file (see TableReplacer)
+ * \param image Where the tables are kept compiled
+ * \param ctxt The global context. Its table is set to the returned tables, which must outlive it.
+ * \throws InvalidInputException if the config file has errors
+ * \throws FileException if the tables can't be compiled or loaded
+ */
+std::unique_ptr<TableReplacer> loadTables(const std::string& config, const std::string& image, Context& ctxt);
+
+/*!
+ * \brief Processes SemTeX from a stream, reading it in fixed-size chunks and writing out each part
+ *        as soon as it is final
+ *
+ * Only text that can't be parsed yet (an unfinished macro, a key cut off at the end of a chunk)
+ * is carried over to the next chunk, so memory use is bounded by the chunk size and the longest macro,
+ * not the size of the input.
+ *
+ * \param in The input to read from
+ * \param out The descriptor to write the LaTeX output to, or -1 to only look for includes
+ * \param ctxt The global context (verbosity level, pool, etc.)
+ */
+void processStream(InputStream& in, int out, Context& ctxt);
+
 #endif
@@ -0,0 +1,150 @@
+#include "precomp.hpp"
+
+#include "IncludeGraph.hpp"
+
+namespace {
+	//! Quotes a file name for dot
+	std::string dotQuoted(const std::string& name)
+	{
+		std::string ret = "\"";
+		for (char c : name) {
+			if (c == '"' || c == '\\')
+				ret += '\\';
+			ret += c;
+		}
+		return ret + "\"";
+	}
+}
+
+std::string IncludeGraph::canonicalPath(const std::string& file)
+{
+	boost::system::error_code ec;
+	const boost::filesystem::path p = boost::filesystem::canonical(file, ec);
+	return ec ? file : p.string();
+}
+
+void IncludeGraph::addRoot(const std::string& file)
+{
+	std::lock_guard<std::mutex> lock(graphMutex);
+	bool isNew;
+	nodeFor(file, isNew);
+}
+
+IncludeGraph::Result IncludeGraph::add(const std::string& parent, const std::string& child,
+                                       std::vector<std::string>& cycle)
+{
+	std::lock_guard<std::mutex> lock(graphMutex);
+	bool parentIsNew, childIsNew;
+	const size_t from = nodeFor(parent, parentIsNew);
+	const size_t to = nodeFor(child, childIsNew);
+
+	// parent -> child closes a cycle if child already leads back to parent
+	if (!childIsNew && findPath(to, from, cycle)) {
+		cycle.insert(cycle.begin(), nodes[from].name);
+		return Result::Cycle;
+	}
+
+	auto& children = nodes[from].children;
+	if (std::find(children.begin(), children.end(), to) == children.end())
+		children.push_back(to);
+
+	return childIsNew ? Result::New : Result::Seen;
+}
+
+bool IncludeGraph::findCycle(const std::string& parent, const std::string& child, std::vector<std::string>& cycle) const
+{
+	std::lock_guard<std::mutex> lock(graphMutex);
+	const size_t from = findNode(parent);
+	const size_t to = findNode(child);
+	if (from == SIZE_MAX || to == SIZE_MAX || !findPath(to, from, cycle))
+		return false;
+
+	cycle.insert(cycle.begin(), nodes[from].name);
+	return true;
+}
+
+void IncludeGraph::removeIncludes(const std::string& file)
+{
+	std::lock_guard<std::mutex> lock(graphMutex);
+	const size_t n = findNode(file);
+	if (n != SIZE_MAX)
+		nodes[n].children.clear();
+}
+
+std::vector<std::string> IncludeGraph::files() const
+{
+	std::lock_guard<std::mutex> lock(graphMutex);
+	std::vector<std::string> ret;
+	ret.reserve(nodes.size());
+	for (const Node& n : nodes)
+		ret.push_back(n.name);
+	return ret;
+}
+
+void IncludeGraph::printDot(FILE* out) const
+{
+	std::lock_guard<std::mutex> lock(graphMutex);
+
+	std::vector<size_t> order(nodes.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [this](size_t a, size_t b) { return nodes[a].name < nodes[b].name; });
+
+	fprintf(out, "digraph includes {\n");
+	for (size_t i : order)
+		fprintf(out, "\t%s;\n", dotQuoted(nodes[i].name).c_str());
+	for (size_t i : order) {
+		std::vector<std::string> children;
+		for (size_t c : nodes[i].children)
+			children.push_back(nodes[c].name);
+		std::sort(children.begin(), children.end());
+		for (const auto& c : children)
+			fprintf(out, "\t%s -> %s;\n", dotQuoted(nodes[i].name).c_str(), dotQuoted(c).c_str());
+	}
+	fprintf(out, "}\n");
+}
+
+size_t IncludeGraph::nodeFor(const std::string& file, bool& isNew)
+{
+	const auto inserted = indices.emplace(canonicalPath(file), nodes.size());
+	isNew = inserted.second;
+	if (isNew)
+		nodes.push_back({file, {}});
+	return inserted.first->second;
+}
+
+size_t IncludeGraph::findNode(const std::string& file) const
+{
+	const auto it = indices.find(canonicalPath(file));
+	return it == indices.end() ? SIZE_MAX : it->second;
+}
+
+bool IncludeGraph::findPath(size_t from, size_t to, std::vector<std::string>& path) const
+{
+	// Depth-first search with an explicit stack, remembering how we got to each node
+	static const size_t unvisited = SIZE_MAX;
+	std::vector<size_t> cameFrom(nodes.size(), unvisited);
+	std::vector<size_t> stack = {from};
+	cameFrom[from] = from;
+	while (!stack.empty()) {
+		const size_t n = stack.back();
+		stack.pop_back();
+		if (n == to) {
+			path.clear();
+			for (size_t at = to; ; at = cameFrom[at]) {
+				path.push_back(nodes[at].name);
+				if (at == from)
+					break;
+			}
+			std::reverse(path.begin(), path.end());
+			return true;
+		}
+		for (size_t c : nodes[n].children) {
+			if (cameFrom[c] == unvisited) {
+				cameFrom[c] = n;
+				stack.push_back(c);
+			}
+		}
+	}
+	return false;
+}
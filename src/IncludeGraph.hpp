@@ -0,0 +1,80 @@
+#ifndef __INCLUDE_GRAPH_HPP__
+#define __INCLUDE_GRAPH_HPP__
+
+/*!
+ * \brief A thread-safe record of which files include which
+ *
+ * Files are identified by their canonical paths, so a file included from several places
+ * (or under several names) is only processed once.
+ * Edges that would close a cycle are refused, so the graph is always a DAG.
+ */
+class IncludeGraph {
+public:
+	//! What happened when an include was added
+	enum class Result {
+		New, //!< The included file hasn't been seen before, and should be processed
+		Seen, //!< The included file has already been seen (and processed, or is being processed)
+		Cycle //!< The include would close a cycle, and was not added
+	};
+
+	IncludeGraph() : graphMutex(), nodes(), indices() { }
+
+	//! Returns the canonical path of a file, or just its name if it doesn't have one (e.g. <stdin>)
+	static std::string canonicalPath(const std::string& file);
+
+	//! Adds a file that isn't included by anything (the file SemTeX was run on)
+	void addRoot(const std::string& file);
+
+	/*!
+	 * \brief Records that parent includes child
+	 * \param cycle If the include would close a cycle, this is set to the files in it,
+	 *              starting and ending with parent
+	 */
+	Result add(const std::string& parent, const std::string& child, std::vector<std::string>& cycle);
+
+	/*!
+	 * \brief Checks if parent including child would close a cycle, without adding anything
+	 * \param cycle Set as it is by add()
+	 * \returns true if it would
+	 */
+	bool findCycle(const std::string& parent, const std::string& child, std::vector<std::string>& cycle) const;
+
+	/*!
+	 * \brief Forgets what a file includes, before it is processed again
+	 *
+	 * Files it included stay in the graph (and so are not processed again when re-added).
+	 */
+	void removeIncludes(const std::string& file);
+
+	//! Returns every file in the graph, by the name it was first seen by
+	std::vector<std::string> files() const;
+
+	//! Writes the graph out in Graphviz's dot format, with files in alphabetical order
+	void printDot(FILE* out) const;
+
+	// No copy or assignment
+	IncludeGraph(const IncludeGraph&) = delete;
+	IncludeGraph& operator=(const IncludeGraph&) = delete;
+
+private:
+	struct Node {
+		std::string name; //!< The name the file was first seen by
+		std::vector<size_t> children; //!< Indices of the files it includes
+	};
+
+	mutable std::mutex graphMutex;
+	std::vector<Node> nodes;
+	std::unordered_map<std::string, size_t> indices; //!< Index in nodes of each canonical path
+
+	//! Returns the index of a file's node, adding one if it's new. graphMutex must be held.
+	size_t nodeFor(const std::string& file, bool& isNew);
+
+	//! Returns the index of a file's node, or SIZE_MAX if there isn't one. graphMutex must be held.
+	size_t findNode(const std::string& file) const;
+
+	//! Finds a path of includes from one node to another. graphMutex must be held.
+	//! \returns true (and the path, as names) if there is one
+	bool findPath(size_t from, size_t to, std::vector<std::string>& path) const;
+};
+
+#endif
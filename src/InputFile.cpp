@@ -0,0 +1,107 @@
+#include "precomp.hpp"
+
+#include "InputFile.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Exceptions.hpp"
+
+const size_t InputFile::kMinMapSize;
+
+InputFile::InputFile(const std::string& filename)
+	: descriptor(open(filename.c_str(), O_RDONLY | O_CLOEXEC)), regular(false), mapped(false),
+	  contents(nullptr), length(0), buff()
+{
+	if (descriptor < 0)
+		throw Exceptions::FileException("Error: Could not open " + filename, __FUNCTION__);
+
+	struct stat st;
+	if (fstat(descriptor, &st) == 0 && S_ISREG(st.st_mode)) {
+		regular = true;
+		length = st.st_size;
+	}
+
+	if (regular && length >= kMinMapSize) {
+		void* m = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		if (m != MAP_FAILED) {
+			madvise(m, length, MADV_SEQUENTIAL);
+			contents = static_cast<const char*>(m);
+			mapped = true;
+			return;
+		}
+		// Fall back to reading if the mapping fails for some reason
+	}
+
+	readAll(filename, length);
+}
+
+InputFile::~InputFile()
+{
+	if (mapped)
+		munmap(const_cast<char*>(contents), length);
+	close(descriptor);
+}
+
+void InputFile::readAll(const std::string& filename, size_t sizeHint)
+{
+	// Pipes and the like don't know their size, so keep reading until we hit the end.
+	buff.resize(std::max<size_t>(sizeHint, 4096));
+	size_t got = 0;
+	while (true) {
+		if (got == buff.size())
+			buff.resize(buff.size() * 2);
+
+		const ssize_t r = read(descriptor, buff.data() + got, buff.size() - got);
+		if (r == 0)
+			break;
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			throw Exceptions::FileException("Error: Could not read " + filename, __FUNCTION__);
+		}
+		got += r;
+	}
+	buff.resize(got);
+	contents = buff.data();
+	length = got;
+}
+
+InputStream::InputStream(const std::string& filename)
+	: filename(filename), descriptor(open(filename.c_str(), O_RDONLY | O_CLOEXEC)), owned(true)
+{
+	if (descriptor < 0)
+		throw Exceptions::FileException("Error: Could not open " + filename, __FUNCTION__);
+
+	posix_fadvise(descriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+InputStream::InputStream(int fd, const std::string& name)
+	: filename(name), descriptor(fd), owned(false)
+{ }
+
+InputStream::~InputStream()
+{
+	if (owned)
+		close(descriptor);
+}
+
+size_t InputStream::read(char* buff, size_t len)
+{
+	// Pipes hand us whatever has been written so far, so keep reading until we have it all
+	size_t got = 0;
+	while (got < len) {
+		const ssize_t r = ::read(descriptor, buff + got, len - got);
+		if (r == 0)
+			break;
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			throw Exceptions::FileException("Error: Could not read " + filename, __FUNCTION__);
+		}
+		got += r;
+	}
+	return got;
+}
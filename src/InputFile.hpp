@@ -0,0 +1,91 @@
+#ifndef __INPUT_FILE_HPP__
+#define __INPUT_FILE_HPP__
+
+/*!
+ * \brief The contents of an input file
+ *
+ * Large regular files are memory-mapped (and the kernel is told we'll read them sequentially),
+ * so parsing works straight out of the page cache instead of a second copy of the file.
+ * Small files, pipes, and anything else that can't be mapped are read into memory.
+ */
+class InputFile {
+public:
+	/*!
+	 * \brief Opens and maps (or reads) the file
+	 * \throws FileException if the file could not be opened or read
+	 */
+	InputFile(const std::string& filename);
+
+	~InputFile();
+
+	const char* data() const { return contents; }
+
+	size_t size() const { return length; }
+
+	//! The file's descriptor, which stays open as long as this object exists
+	int fd() const { return descriptor; }
+
+	//! True if this is a regular file (and not a pipe, etc.)
+	bool isRegular() const { return regular; }
+
+	//! True if the contents are memory-mapped
+	bool isMapped() const { return mapped; }
+
+	// No copy or assignment
+	InputFile(const InputFile&) = delete;
+	InputFile& operator=(const InputFile&) = delete;
+
+private:
+	static const size_t kMinMapSize = 64 * 1024; //!< Files smaller than this are just read into memory
+
+	int descriptor;
+	bool regular;
+	bool mapped;
+	const char* contents;
+	size_t length;
+	std::vector<char> buff; //!< Holds the contents if they were read instead of mapped
+
+	//! Reads the rest of the file into buff
+	void readAll(const std::string& filename, size_t sizeHint);
+};
+
+/*!
+ * \brief An input that is read a piece at a time (see processStream())
+ *
+ * Unlike InputFile, this works the same for files, pipes, and terminals, and never holds more
+ * of the input than the caller asks for.
+ */
+class InputStream {
+public:
+	/*!
+	 * \brief Opens the file
+	 * \throws FileException if the file could not be opened
+	 */
+	InputStream(const std::string& filename);
+
+	//! Reads from an already open descriptor (such as stdin), which is not closed on destruction
+	InputStream(int fd, const std::string& name);
+
+	~InputStream();
+
+	/*!
+	 * \brief Reads len bytes, or fewer if the end of the input is hit first
+	 * \returns The number of bytes read. Anything less than len means we hit the end of the input.
+	 * \throws FileException on a read error
+	 */
+	size_t read(char* buff, size_t len);
+
+	//! The name of the input, for messages
+	const std::string& name() const { return filename; }
+
+	// No copy or assignment
+	InputStream(const InputStream&) = delete;
+	InputStream& operator=(const InputStream&) = delete;
+
+private:
+	const std::string filename;
+	const int descriptor;
+	const bool owned; //!< True if we opened descriptor and should close it
+};
+
+#endif
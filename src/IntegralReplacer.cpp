@@ -5,19 +5,15 @@
 #include "Exceptions.hpp"
 #include "FileParser.hpp"
 
-static std::unordered_set<std::string> acceptedFlags({"inf", "lim", "mir"});
+static const StringView acceptedFlags[] = {"inf", "lim", "mir"};
 
-IntegralReplacer::IntegralReplacer()
-	: Replacer({"\\integral"})
-{ }
-
-void IntegralReplacer::replace(const std::string& matchedKey, Parser& p)
+void IntegralReplacer::replace(StringView matchedKey, Parser& p)
 {
 	const char* start = p.curr;
 	p.curr += matchedKey.length();
 
-	std::unique_ptr<MacroOptions> options;
-	decltype(p.parseBracketArgs()) argList;
+	MacroOptions options;
+	ArgList argList;
 	try {
 		options = p.parseMacroOptions();
 		argList = p.parseBracketArgs();
@@ -26,31 +22,31 @@ void IntegralReplacer::replace(const std::string& matchedKey, Parser& p)
 		throw Exceptions::InvalidInputException(ex.message + " in " + matchedKey, __FUNCTION__);
 	}
 
-	if (options->opts.size() != 0)
+	if (options.opts.size() != 0)
 		p.errorOnLine(matchedKey + " does not take options\n\t(it only takes the flags \"inf\" and \"mir\")");
 
-	for (const auto& flag : options->flags) {
-		if (acceptedFlags.find(flag) == acceptedFlags.end())
+	for (const auto& flag : options.flags) {
+		if (std::find(std::begin(acceptedFlags), std::end(acceptedFlags), flag) == std::end(acceptedFlags))
 			p.errorOnLine("Unknown argument \"" + flag + "\" for \\integral");
 	}
 
-	const size_t numArgs = argList->size();
+	const size_t numArgs = argList.size();
 
 	if (numArgs > 4)
 		p.errorOnLine("Too many arguments for " + matchedKey);
 
-	bool inf = options->flags.find("inf") != options->flags.end();
-	bool lim = options->flags.find("lim") != options->flags.end();
-	bool mir = options->flags.find("mir") != options->flags.end();
+	bool inf = options.hasFlag("inf");
+	bool lim = options.hasFlag("lim");
+	bool mir = options.hasFlag("mir");
 
 	// Arg 0 is the expression
 	// Arg 1 is with respect to (d_)
 	// Arg 2 is the lower bound
 	// Arg 3 is the upper bound
-	const std::string* expr = numArgs >= 1 && !argList->at(0).empty() ? &argList->at(0) : nullptr;
-	const std::string* wrt = numArgs >= 2 && !argList->at(1).empty() ? &argList->at(1) : nullptr;
-	const std::string* lower = numArgs >= 3 && !argList->at(2).empty() ? &argList->at(2) : nullptr;
-	const std::string* upper = numArgs >= 4 && !argList->at(3).empty() ? &argList->at(3) : nullptr;
+	const StringView* expr = numArgs >= 1 && !argList[0].empty() ? &argList[0] : nullptr;
+	const StringView* wrt = numArgs >= 2 && !argList[1].empty() ? &argList[1] : nullptr;
+	const StringView* lower = numArgs >= 3 && !argList[2].empty() ? &argList[2] : nullptr;
+	const StringView* upper = numArgs >= 4 && !argList[3].empty() ? &argList[3] : nullptr;
 
 	if (mir && upper != nullptr)
 		p.warningOnLine(matchedKey + " is ignoring the \"mirror bounds\" option since two bounds were provided.");
@@ -58,27 +54,43 @@ void IntegralReplacer::replace(const std::string& matchedKey, Parser& p)
 	if (!mir && inf && upper != nullptr && lower != nullptr)
 		p.warningOnLine(matchedKey +  "is ignoring the \"infinity bounds\" option since two bounds were provided.");
 
-	std::string replacement = "\\int";
+	ReplacementText replacement(p);
+	replacement += "\\int";
 	if ((lower != nullptr || upper != nullptr || inf) && lim)
 		replacement += "\\limits";
 
-	if (lower != nullptr)
-		replacement += "_{" + ((mir ? "-" : "") + *lower) + "}";
+	if (lower != nullptr) {
+		replacement += "_{";
+		if (mir)
+			replacement += "-";
+		replacement.splice(*lower);
+		replacement += "}";
+	}
 	else if (inf)
 		replacement += "_{-\\infty}";
 
-	if (upper != nullptr)
-		replacement += "^{" + *upper + "}";
-	else if (mir && lower != nullptr)
-		replacement +=  "^{" + *lower + "}";
+	if (upper != nullptr) {
+		replacement += "^{";
+		replacement.splice(*upper);
+		replacement += "}";
+	}
+	else if (mir && lower != nullptr) {
+		replacement += "^{";
+		replacement.splice(*lower);
+		replacement += "}";
+	}
 	else if (inf)
 		replacement += "^{\\infty}";
 
-	if (expr != nullptr)
-		replacement += " " + *expr;
+	if (expr != nullptr) {
+		replacement += " ";
+		replacement.splice(*expr);
+	}
 
-	if (wrt != nullptr)
-		replacement += "\\,\\mathrm{d}" + *wrt;
+	if (wrt != nullptr) {
+		replacement += "\\,\\mathrm{d}";
+		replacement.splice(*wrt);
+	}
 
-	p.replacements.emplace_back(start, p.curr, std::move(replacement));
+	p.emit(start, replacement);
 }
@@ -6,11 +6,17 @@
 //! Replaces \\integral{args} with a properly formatted LaTeX integral
 class IntegralReplacer final : public Replacer {
 public:
-	IntegralReplacer();
+	void replace(StringView matchedKey, Parser& p) override;
 
-	void replace(const std::string& matchedKey, Parser& p) override;
+	size_t numKeys() const override { return 1; }
+
+	StringView key(size_t) const override { return "\\integral"; }
 
 	bool shouldRecurse() const override { return true; }
+
+	bool isPure() const override { return true; }
+
+	unsigned int modes() const override { return Math; }
 };
 
 #endif
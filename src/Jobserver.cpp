@@ -0,0 +1,142 @@
+#include "precomp.hpp"
+
+#include "Jobserver.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+	//! Returns true if fd is an open pipe or FIFO
+	bool isPipe(int fd)
+	{
+		struct stat st;
+		return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+	}
+}
+
+std::unique_ptr<Jobserver> Jobserver::fromEnvironment(Status& status)
+{
+	status = Status::None;
+
+	const char* makeflags = getenv("MAKEFLAGS");
+	if (makeflags == nullptr)
+		return nullptr;
+
+	// Newer versions of make call it --jobserver-auth. Older ones call it --jobserver-fds.
+	// If it shows up more than once, the last one wins.
+	static const std::array<const std::string, 2> prefixes = {{"--jobserver-auth=", "--jobserver-fds="}};
+	std::string auth;
+	std::istringstream words(makeflags);
+	std::string word;
+	while (words >> word) {
+		for (const auto& prefix : prefixes) {
+			if (word.compare(0, prefix.length(), prefix) == 0)
+				auth = word.substr(prefix.length());
+		}
+	}
+	if (auth.empty())
+		return nullptr;
+
+	status = Status::Unusable;
+
+	int rfd = -1;
+	int wfd = -1;
+	bool ownsWrite = true;
+	if (auth.compare(0, 5, "fifo:") == 0) {
+		// make 4.4 and later use a named FIFO, which we can just open ourselves.
+		// Open it for reading first so that opening it for writing doesn't wait for a reader.
+		const std::string path = auth.substr(5);
+		rfd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (rfd >= 0)
+			wfd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+	}
+	else {
+		// Older versions hand us the two ends of a pipe. If the recipe running us wasn't marked as recursive,
+		// make will have closed them (and the numbers may since have been reused), so make sure they are pipes.
+		int r, w;
+		if (sscanf(auth.c_str(), "%d,%d", &r, &w) != 2 || !isPipe(r) || !isPipe(w))
+			return nullptr;
+
+		// Reopen the read end so we have a non-blocking descriptor of our own.
+		// Setting O_NONBLOCK on the one make gave us would change it for make and everyone else sharing it.
+		rfd = open(("/proc/self/fd/" + std::to_string(r)).c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		wfd = w;
+		ownsWrite = false;
+	}
+
+	if (rfd < 0 || wfd < 0) {
+		if (rfd >= 0)
+			close(rfd);
+		if (wfd >= 0 && ownsWrite)
+			close(wfd);
+		return nullptr;
+	}
+
+	std::unique_ptr<Jobserver> ret(new Jobserver(rfd, wfd, ownsWrite));
+	if (ret->cancelPipe[0] < 0)
+		return nullptr;
+
+	status = Status::Connected;
+	return ret;
+}
+
+Jobserver::Jobserver(int rfd, int wfd, bool ownsWrite)
+	: readFd(rfd), writeFd(wfd), ownsWriteFd(ownsWrite), cancelPipe(), tokensMutex(), tokens()
+{
+	if (pipe2(cancelPipe, O_CLOEXEC) != 0)
+		cancelPipe[0] = cancelPipe[1] = -1;
+}
+
+Jobserver::~Jobserver()
+{
+	close(readFd);
+	if (ownsWriteFd)
+		close(writeFd);
+	if (cancelPipe[0] >= 0) {
+		close(cancelPipe[0]);
+		close(cancelPipe[1]);
+	}
+}
+
+bool Jobserver::acquire()
+{
+	while (true) {
+		char token;
+		const ssize_t got = read(readFd, &token, 1);
+		if (got == 1) {
+			std::lock_guard<std::mutex> lock(tokensMutex);
+			tokens.push_back(token);
+			return true;
+		}
+		if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+			return false;
+
+		// Someone else got there first (or there was nothing there). Wait for another token, or for cancel().
+		struct pollfd fds[2] = {{readFd, POLLIN, 0}, {cancelPipe[0], POLLIN, 0}};
+		if (poll(fds, 2, -1) < 0 && errno != EINTR)
+			return false;
+		if (fds[1].revents != 0)
+			return false;
+	}
+}
+
+void Jobserver::release()
+{
+	char token = '+';
+	{
+		std::lock_guard<std::mutex> lock(tokensMutex);
+		if (!tokens.empty()) {
+			token = tokens.back();
+			tokens.pop_back();
+		}
+	}
+	while (write(writeFd, &token, 1) < 0 && errno == EINTR) { }
+}
+
+void Jobserver::cancel()
+{
+	const char c = 0;
+	while (write(cancelPipe[1], &c, 1) < 0 && errno == EINTR) { }
+}
@@ -0,0 +1,59 @@
+#ifndef __JOBSERVER_HPP__
+#define __JOBSERVER_HPP__
+
+/*!
+ * \brief A client for the GNU make jobserver
+ *
+ * When make runs with -j, it hands its children a pipe (or named FIFO) holding one byte
+ * for each job slot it has left. Every process gets one slot for free. To run anything else
+ * in parallel it has to read a byte (a token) from the jobserver first, and write it back when done.
+ * This keeps the total number of running jobs at what make was given, no matter how they are split
+ * between make and its children.
+ */
+class Jobserver {
+public:
+	//! What fromEnvironment() found
+	enum class Status {
+		None, //!< MAKEFLAGS doesn't name a jobserver
+		Connected, //!< Connected to the jobserver
+		Unusable //!< MAKEFLAGS names a jobserver, but we couldn't use it (e.g. make didn't pass us its pipe)
+	};
+
+	/*!
+	 * \brief Connects to the jobserver named in MAKEFLAGS (as --jobserver-auth or --jobserver-fds), if any
+	 * \param status Set to whether we found a jobserver and could connect to it
+	 * \returns The jobserver, or nullptr unless status is Connected
+	 */
+	static std::unique_ptr<Jobserver> fromEnvironment(Status& status);
+
+	//! Closes whatever we opened. Any tokens still held should have been released by now.
+	~Jobserver();
+
+	/*!
+	 * \brief Waits for a token
+	 * \returns true once we have one, or false if we never will (cancel() was called, or the jobserver broke)
+	 */
+	bool acquire();
+
+	//! Hands a token back to the jobserver
+	void release();
+
+	//! Makes acquire() return false from now on, waking up anyone waiting in it
+	void cancel();
+
+	// No copy or assignment
+	Jobserver(const Jobserver&) = delete;
+	Jobserver& operator=(const Jobserver&) = delete;
+
+private:
+	int readFd; //!< Our own non-blocking descriptor for reading tokens
+	int writeFd; //!< Where tokens are written back
+	bool ownsWriteFd; //!< False if writeFd is the descriptor make handed us
+	int cancelPipe[2]; //!< Written to by cancel() so waiting in acquire() can be interrupted
+	std::mutex tokensMutex;
+	std::vector<char> tokens; //!< The tokens we hold. Make expects to get the same bytes back.
+
+	Jobserver(int rfd, int wfd, bool ownsWrite);
+};
+
+#endif
@@ -0,0 +1,44 @@
+#include "precomp.hpp"
+
+#include "KeyMatcher.hpp"
+
+#include "Exceptions.hpp"
+
+const size_t KeyMatcher::kMaxKeys;
+const size_t KeyMatcher::kMaxKeyBytes;
+
+std::string KeyTrie::firstBytes(const uint32_t* rootNext)
+{
+	std::string ret;
+	for (size_t b = 0; b < 256; ++b) {
+		if (rootNext[b] != 0)
+			ret += static_cast<char>(b);
+	}
+	return ret;
+}
+
+void KeyMatcher::add(const Entry& e)
+{
+	size_t keyBytes = e.key.size();
+	for (size_t i = 0; i < numEntries; ++i)
+		keyBytes += entries[i].key.size();
+	if (numEntries == kMaxKeys || keyBytes > kMaxKeyBytes)
+		throw Exceptions::InvalidOperationException("Error: Replacers have too many keys to match", __FUNCTION__);
+	entries[numEntries++] = e;
+	longestKey = std::max(longestKey, e.key.size());
+}
+
+void KeyMatcher::build()
+{
+	// If two replacers share a key, the first one registered wins, so keep them in order when sorting.
+	// An insertion sort is stable, doesn't allocate (unlike std::stable_sort), and there are only so many keys.
+	for (size_t i = 1; i < numEntries; ++i) {
+		const Entry e = entries[i];
+		size_t j = i;
+		for (; j > 0 && e.key < entries[j - 1].key; --j)
+			entries[j] = entries[j - 1];
+		entries[j] = e;
+	}
+	KeyTrie::build([this](size_t i) { return entries[i].key; }, numEntries, states.data(), edges.data(),
+	               rootNext.data());
+}
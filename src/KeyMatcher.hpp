@@ -0,0 +1,94 @@
+#ifndef __KEY_MATCHER_HPP__
+#define __KEY_MATCHER_HPP__
+
+#include "KeyTrie.hpp"
+
+class Replacer;
+
+/*!
+ * \brief A prefix automaton compiled from the keys of every Replacer that applies in a mode (text or math)
+ *
+ * The automaton is a trie flattened into two arrays (states and sorted edges),
+ * with a dense transition table for the root since every lookup starts there (see KeyTrie).
+ * A lookup walks forward from the current position one byte at a time,
+ * remembering the last key it passed, so it finds the longest matching key of any
+ * replacer without building strings or searching each replacer's key set in turn.
+ *
+ * Every built-in replacer's keys fit in fixed-size arrays, so building it allocates nothing.
+ */
+class KeyMatcher {
+public:
+	//! A key and the replacer it belongs to
+	struct Entry {
+		Replacer* owner;
+		StringView key;
+
+		Entry() : owner(nullptr), key() { }
+		Entry(Replacer* owner, StringView key) : owner(owner), key(key) { }
+	};
+
+	/*!
+	 * \brief Builds the automaton from the keys of the provided replacers that apply in the given mode
+	 * \param mode A Replacer::Mode. Replacers that don't apply in it (see Replacer::modes()) are left out.
+	 * \throws InvalidOperationException if there are more keys than fit
+	 */
+	template <typename It>
+	KeyMatcher(It firstReplacer, It lastReplacer, unsigned int mode)
+		: states(), edges(), rootNext(), entries(), numEntries(0), longestKey(0)
+	{
+		for (; firstReplacer != lastReplacer; ++firstReplacer) {
+			if (((*firstReplacer)->modes() & mode) == 0)
+				continue;
+			for (size_t k = 0; k < (*firstReplacer)->numKeys(); ++k)
+				add({*firstReplacer, (*firstReplacer)->key(k)});
+		}
+		build();
+	}
+
+	/*!
+	 * \brief Finds the longest key that starts at the given location
+	 * \param curr The location to match at
+	 * \param end One past the last character that can be examined
+	 * \returns The matched key and its owner, or nullptr if no key matches
+	 *
+	 * Keys ending in a letter are not matched when followed by another letter,
+	 * since that is probably some LaTeX command that happens to start with our key
+	 * (e.g. \\sinc vs. \\sincos).
+	 */
+	const Entry* match(const char* curr, const char* end) const
+	{
+		const uint32_t e = KeyTrie::match({states.data(), edges.data(), rootNext.data()}, curr, end);
+		return e == KeyTrie::kNoEntry ? nullptr : &entries[e];
+	}
+
+	//! Returns true if some key starts with the given byte
+	bool startsKey(unsigned char b) const { return rootNext[b] != 0; }
+
+	//! Returns every byte that some key starts with
+	std::string firstBytes() const { return KeyTrie::firstBytes(rootNext.data()); }
+
+	//! Returns the length of the longest key
+	size_t maxKeyLength() const { return longestKey; }
+
+	// No copy or assignment
+	KeyMatcher(const KeyMatcher&) = delete;
+	KeyMatcher& operator=(const KeyMatcher&) = delete;
+
+private:
+	static const size_t kMaxKeys = 128;
+	static const size_t kMaxKeyBytes = 1024; //!< The total length of every key
+
+	std::array<KeyTrie::State, kMaxKeyBytes + 1> states;
+	std::array<KeyTrie::Edge, kMaxKeyBytes> edges;
+	std::array<uint32_t, 256> rootNext;
+	std::array<Entry, kMaxKeys> entries; //!< Sorted by key once the automaton is built
+	size_t numEntries;
+	size_t longestKey;
+
+	//! Adds a key, throwing if it doesn't fit
+	void add(const Entry& e);
+
+	void build();
+};
+
+#endif
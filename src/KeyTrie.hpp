@@ -0,0 +1,132 @@
+#ifndef __KEY_TRIE_HPP__
+#define __KEY_TRIE_HPP__
+
+#include "StringView.hpp"
+
+/*!
+ * \brief A trie of keys flattened into plain arrays, so it can be searched in place
+ *        wherever those arrays live (in a KeyMatcher, or in a mapped TableReplacer image)
+ *
+ * States and edges are fixed-size records of 32-bit fields with no padding,
+ * so a trie can be written to a file and mapped back in as-is.
+ */
+namespace KeyTrie {
+	const uint32_t kNoEntry = UINT32_MAX;
+
+	struct State {
+		uint32_t firstEdge; //!< Index of this state's first edge
+		uint32_t numEdges; //!< Number of edges leaving this state
+		uint32_t entry; //!< Index of the key ending at this state, or kNoEntry
+	};
+
+	struct Edge {
+		uint32_t byte;
+		uint32_t target;
+	};
+
+	//! A trie, wherever it is stored
+	struct View {
+		const State* states; //!< State 0 is the root
+		const Edge* edges; //!< Edges, grouped by state and sorted by byte within each group
+		const uint32_t* rootNext; //!< 256 dense transitions out of the root (0 means none)
+	};
+
+	/*!
+	 * \brief Builds a trie of keys without allocating anything
+	 * \param keyAt Returns the ith key. Keys must be sorted. If a key is repeated, the first copy wins.
+	 * \param numKeys The number of keys
+	 * \param states Where to put the states. Needs room for 1 + the total length of the keys.
+	 * \param edges Where to put the edges. Needs room for the total length of the keys.
+	 * \param rootNext Where to put the 256 dense transitions out of the root
+	 * \returns The number of states (there is one fewer edge). Entry indexes are indexes of keys.
+	 *
+	 * States are numbered breadth-first, each time giving every child of a state the next numbers,
+	 * so that a state's edges are together and sorted by byte. Until it is reached, a state's
+	 * firstEdge and numEdges hold the range of keys that pass through it.
+	 */
+	template <typename KeyAt>
+	uint32_t build(KeyAt keyAt, size_t numKeys, State* states, Edge* edges, uint32_t* rootNext)
+	{
+		uint32_t numStates = 1;
+		uint32_t numEdges = 0;
+		states[0] = {0, static_cast<uint32_t>(numKeys), kNoEntry};
+
+		size_t depth = 0; // The length of the prefix every key passing through the current state shares
+		uint32_t depthEnd = 1; // The first state one level deeper
+		for (uint32_t s = 0; s < numStates; ++s) {
+			if (s == depthEnd) {
+				++depth;
+				depthEnd = numStates;
+			}
+
+			uint32_t k = states[s].firstEdge;
+			const uint32_t last = states[s].numEdges;
+			states[s] = {numEdges, 0, kNoEntry};
+			if (k < last && keyAt(k).size() == depth)
+				states[s].entry = k;
+			while (k < last && keyAt(k).size() == depth)
+				++k;
+
+			// Each run of keys with the same next byte goes through the same child
+			while (k < last) {
+				const unsigned char b = static_cast<unsigned char>(keyAt(k)[depth]);
+				const uint32_t first = k;
+				while (k < last && static_cast<unsigned char>(keyAt(k)[depth]) == b)
+					++k;
+				states[numStates] = {first, k, kNoEntry};
+				edges[numEdges++] = {b, numStates++};
+				++states[s].numEdges;
+			}
+		}
+
+		std::fill(rootNext, rootNext + 256, 0);
+		for (uint32_t e = 0; e < states[0].numEdges; ++e)
+			rootNext[edges[e].byte] = edges[e].target;
+		return numStates;
+	}
+
+	/*!
+	 * \brief Finds the longest key that starts at curr
+	 * \returns Its entry index, or kNoEntry if no key matches
+	 *
+	 * Keys ending in a letter are not matched when followed by another letter,
+	 * since that is probably some LaTeX command that happens to start with our key
+	 * (e.g. \\sinc vs. \\sincos).
+	 */
+	inline uint32_t match(const View& t, const char* curr, const char* end)
+	{
+		if (curr >= end)
+			return kNoEntry;
+
+		uint32_t state = t.rootNext[static_cast<unsigned char>(*curr)];
+		const char* p = curr + 1;
+		uint32_t best = kNoEntry;
+
+		while (state != 0) {
+			const State& s = t.states[state];
+			if (s.entry != kNoEntry && !(p < end && isalpha(*p) && isalpha(*(p - 1))))
+				best = s.entry;
+
+			if (p >= end || s.numEdges == 0)
+				break;
+
+			// Edge lists are tiny (a handful of bytes at most), so a linear scan beats a binary search.
+			const uint32_t b = static_cast<unsigned char>(*p);
+			const Edge* e = &t.edges[s.firstEdge];
+			const Edge* const eEnd = e + s.numEdges;
+			while (e < eEnd && e->byte < b)
+				++e;
+			if (e == eEnd || e->byte != b)
+				break;
+
+			state = e->target;
+			++p;
+		}
+		return best;
+	}
+
+	//! Returns every byte that some key starts with
+	std::string firstBytes(const uint32_t* rootNext);
+}
+
+#endif
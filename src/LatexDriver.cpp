@@ -0,0 +1,316 @@
+#include "precomp.hpp"
+
+#include "LatexDriver.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "BuildCache.hpp"
+#include "Exceptions.hpp"
+#include "InputFile.hpp"
+
+extern char** environ;
+
+namespace {
+	//! Files LaTeX writes for its next pass, then the ones other programs write for it.
+	//! If any of them change during a pass, LaTeX has to run again.
+	const std::array<const char*, 7> kRereadExtensions = {{".aux", ".toc", ".lof", ".lot", ".out", ".bbl", ".ind"}};
+
+	bool exists(const std::string& file) { return FileStamp::of(file).exists; }
+
+	//! Hashes a file's contents, or returns 0 if it doesn't exist
+	uint64_t hashFile(const std::string& file)
+	{
+		if (!exists(file))
+			return 0;
+
+		const InputFile in(file);
+		return hashBytes(in.data(), in.size());
+	}
+
+	//! Hashes each of the files LaTeX rereads (see kRereadExtensions)
+	std::vector<uint64_t> hashRereadFiles(const std::string& job)
+	{
+		std::vector<uint64_t> ret;
+		for (const char* ext : kRereadExtensions)
+			ret.push_back(hashFile(job + ext));
+		return ret;
+	}
+
+	/*!
+	 * \brief Hashes the lines BibTeX reads from a .aux file (and the .aux files of \include'd files)
+	 * \param dir Where LaTeX wrote the .aux files (as a prefix, so "" or ending in a slash)
+	 * \param databases Set to the .bib files named
+	 * \returns The hash, or 0 if the document doesn't have a BibTeX bibliography
+	 */
+	uint64_t bibtexInputs(const std::string& dir, const std::string& aux, std::vector<std::string>& databases)
+	{
+		static const std::array<const std::string, 3> bibLines = {{"\\citation{", "\\bibdata{", "\\bibstyle{"}};
+		static const std::string inputLine = "\\@input{";
+
+		uint64_t hash = hashBytes(nullptr, 0);
+		bool haveData = false;
+		std::vector<std::string> auxFiles = {dir + aux};
+		while (!auxFiles.empty()) {
+			std::ifstream in(auxFiles.back());
+			auxFiles.pop_back();
+			std::string line;
+			while (std::getline(in, line)) {
+				const auto startsWith = [&](const std::string& s) { return line.compare(0, s.size(), s) == 0; };
+				const auto argument = [&](const std::string& s) {
+					const size_t close = line.find('}', s.size());
+					return line.substr(s.size(), close == std::string::npos ? std::string::npos : close - s.size());
+				};
+
+				if (startsWith(inputLine)) {
+					auxFiles.push_back(dir + argument(inputLine));
+					continue;
+				}
+				if (std::none_of(bibLines.begin(), bibLines.end(), startsWith))
+					continue;
+
+				hash = hashBytes(line.data(), line.size(), hash);
+				if (startsWith(bibLines[1])) {
+					haveData = true;
+					std::vector<std::string> names;
+					boost::split(names, argument(bibLines[1]), boost::is_any_of(","));
+					for (const auto& n : names)
+						databases.push_back(boost::algorithm::ends_with(n, ".bib") ? n : n + ".bib");
+				}
+			}
+		}
+		return haveData ? hash : 0;
+	}
+
+	/*!
+	 * \brief Hashes the control file biblatex writes for Biber
+	 * \param databases Set to the data sources it names
+	 * \returns The hash, or 0 if there isn't one
+	 */
+	uint64_t biberInputs(const std::string& bcf, std::vector<std::string>& databases)
+	{
+		if (!exists(bcf))
+			return 0;
+
+		const InputFile in(bcf);
+		const std::string contents(in.data(), in.size());
+		static const boost::regex datasource(R"regex(<bcf:datasource[^>]*>([^<]*)</bcf:datasource>)regex",
+		                                     boost::regex::optimize);
+		for (boost::sregex_iterator it(contents.begin(), contents.end(), datasource), end; it != end; ++it)
+			databases.push_back((*it)[1]);
+		return hashBytes(contents.data(), contents.size());
+	}
+
+	/*!
+	 * \brief Copies our environment, putting each of the given directories at the front of a search path
+	 * \param searchPaths Variable names, and what to put at the front of them
+	 */
+	std::vector<std::string> environmentWith(const std::map<std::string, std::string>& searchPaths)
+	{
+		std::vector<std::string> ret;
+		std::unordered_set<std::string> seen;
+		for (char** e = environ; *e != nullptr; ++e) {
+			const std::string var(*e);
+			const auto it = searchPaths.find(var.substr(0, var.find('=')));
+			if (it == searchPaths.end()) {
+				ret.push_back(var);
+				continue;
+			}
+			ret.push_back(it->first + "=" + it->second + ":" + var.substr(it->first.size() + 1));
+			seen.insert(it->first);
+		}
+		// A trailing colon means the rest of the default search path
+		for (const auto& kv : searchPaths) {
+			if (seen.count(kv.first) == 0)
+				ret.push_back(kv.first + "=" + kv.second + ":");
+		}
+		return ret;
+	}
+
+	//! True if target doesn't exist, or any of files was modified after it
+	bool outOfDate(const std::string& target, const std::vector<std::string>& files)
+	{
+		const FileStamp t = FileStamp::of(target);
+		return !t.exists || std::any_of(files.begin(), files.end(),
+		                                [&](const std::string& f) { return FileStamp::of(f).mtime > t.mtime; });
+	}
+}
+
+LatexDriver::LatexDriver(const std::string& program, std::chrono::seconds t, bool v)
+	: latexCommand(), timeout(t), verbose(v), outputDir(), environment()
+{
+	boost::split(latexCommand, program, boost::is_any_of(" \t"), boost::token_compress_on);
+	latexCommand.erase(std::remove(latexCommand.begin(), latexCommand.end(), std::string()), latexCommand.end());
+	if (latexCommand.empty())
+		throw Exceptions::InvalidInputException("Error: No LaTeX program was given", __FUNCTION__);
+}
+
+void LatexDriver::setOutputDirectory(const std::string& dir)
+{
+	outputDir = dir;
+	const std::string here = boost::filesystem::current_path().string();
+	environment = environmentWith({{"TEXINPUTS", dir}, {"BIBINPUTS", here}, {"BSTINPUTS", here}, {"INDEXSTYLE", here}});
+}
+
+bool LatexDriver::build(const std::string& texFile)
+{
+	// LaTeX writes its files to the output directory, named after the file it was run on.
+	// Everything else is run there too (so jobName works from there), but we look at them from here.
+	const std::string dir = outputDir.empty() ? std::string() : outputDir + "/";
+	const std::string jobName = boost::filesystem::path(texFile).stem().string();
+	const std::string job = dir + jobName;
+
+	std::vector<std::string> latex = latexCommand;
+	latex.push_back("-interaction=nonstopmode");
+	if (!outputDir.empty())
+		latex.push_back("-output-directory=" + outputDir);
+	latex.push_back(texFile);
+
+	// Start from what the last build left behind, so rebuilding a document that hasn't changed
+	// (in ways that matter to the next pass) takes just one pass.
+	std::vector<uint64_t> before = hashRereadFiles(job);
+	std::vector<std::string> databases;
+	uint64_t bibBefore = exists(job + ".bcf") ? biberInputs(job + ".bcf", databases)
+	                                          : bibtexInputs(dir, jobName + ".aux", databases);
+	uint64_t indexBefore = hashFile(job + ".idx");
+
+	for (unsigned int pass = 1; ; ++pass) {
+		if (verbose)
+			printf("Running %s on %s (pass %u)...\n", latex[0].c_str(), texFile.c_str(), pass);
+		if (!run(latex))
+			return false;
+
+		// biblatex writes a .bcf for Biber. Otherwise the .aux says what BibTeX needs.
+		databases.clear();
+		const bool biber = exists(job + ".bcf");
+		const uint64_t bib = biber ? biberInputs(job + ".bcf", databases)
+		                           : bibtexInputs(dir, jobName + ".aux", databases);
+		if (bib != 0 && (bib != bibBefore || outOfDate(job + ".bbl", databases))) {
+			const std::string bibProgram = biber ? "biber" : "bibtex";
+			if (verbose)
+				printf("Citations or bibliography changed. Running %s...\n", bibProgram.c_str());
+			if (!run({bibProgram, jobName}, outputDir))
+				return false;
+		}
+		bibBefore = bib;
+
+		const uint64_t index = hashFile(job + ".idx");
+		if (index != 0 && (index != indexBefore || !exists(job + ".ind"))) {
+			if (verbose)
+				printf("Index entries changed. Running makeindex...\n");
+			if (!run({"makeindex", jobName + ".idx"}, outputDir))
+				return false;
+		}
+		indexBefore = index;
+
+		const std::vector<uint64_t> after = hashRereadFiles(job);
+		if (after == before) {
+			if (verbose)
+				printf("Nothing %s reads back changed. Done after %u pass(es).\n", latex[0].c_str(), pass);
+			return true;
+		}
+		if (pass == kMaxPasses) {
+			printf("Warning: %s's auxiliary files were still changing after %u passes. "
+			       "Cross-references may be wrong.\n", latex[0].c_str(), pass);
+			return true;
+		}
+		before = after;
+	}
+}
+
+bool LatexDriver::run(const std::vector<std::string>& args, const std::string& dir)
+{
+	// Build everything the child needs before forking. Other threads may hold locks (like malloc's)
+	// that will never be released in the child.
+	std::vector<char*> argv;
+	for (const auto& a : args)
+		argv.push_back(const_cast<char*>(a.c_str()));
+	argv.push_back(nullptr);
+	std::vector<char*> envp;
+	for (const auto& e : environment)
+		envp.push_back(const_cast<char*>(e.c_str()));
+	envp.push_back(nullptr);
+	char* const* const childEnv = environment.empty() ? environ : envp.data();
+	const std::string execError = "Error: Could not run " + args[0] + "\n";
+
+	int out[2];
+	if (pipe2(out, O_CLOEXEC) != 0)
+		throw Exceptions::FileException("Error: Could not create a pipe to read " + args[0] + "'s output", __FUNCTION__);
+
+	fflush(stdout); // Don't let the child inherit anything we haven't printed yet
+	const pid_t pid = fork();
+	if (pid < 0) {
+		close(out[0]);
+		close(out[1]);
+		throw Exceptions::FileException("Error: Could not start " + args[0], __FUNCTION__);
+	}
+	if (pid == 0) {
+		// Give it a process group of its own, so if it times out, anything it started is killed too
+		setpgid(0, 0);
+		const int devNull = open("/dev/null", O_RDONLY);
+		dup2(devNull, STDIN_FILENO);
+		dup2(out[1], STDOUT_FILENO);
+		dup2(out[1], STDERR_FILENO);
+		if (dir.empty() || chdir(dir.c_str()) == 0)
+			execvpe(argv[0], argv.data(), childEnv);
+		if (write(STDERR_FILENO, execError.data(), execError.size()) < 0) { } // Nothing else we can do
+		_exit(127);
+	}
+	setpgid(pid, pid); // In case we get to killing it before the child gets to it
+	close(out[1]);
+
+	std::string output;
+	bool timedOut = false;
+	const auto deadline = std::chrono::steady_clock::now() + timeout;
+	char buff[4096];
+	for (;;) {
+		int wait = -1;
+		if (timeout.count() > 0) {
+			const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+				deadline - std::chrono::steady_clock::now()).count();
+			if (left <= 0) {
+				timedOut = true;
+				break;
+			}
+			wait = static_cast<int>(left);
+		}
+
+		struct pollfd p = {out[0], POLLIN, 0};
+		if (poll(&p, 1, wait) <= 0)
+			continue; // Timed out (checked above) or interrupted
+
+		const ssize_t got = read(out[0], buff, sizeof(buff));
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			break;
+
+		output.append(buff, got);
+		if (verbose)
+			fwrite(buff, 1, got, stdout);
+	}
+	close(out[0]);
+
+	if (timedOut)
+		kill(-pid, SIGKILL);
+	int status;
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+		;
+
+	const bool succeeded = !timedOut && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	if (!succeeded) {
+		// Show what it had to say, if we haven't already
+		if (!verbose)
+			fwrite(output.data(), 1, output.size(), stdout);
+		fflush(stdout);
+		if (timedOut)
+			fprintf(stderr, "Error: %s ran for more than %lld seconds, and was stopped\n",
+			        args[0].c_str(), static_cast<long long>(timeout.count()));
+		else
+			fprintf(stderr, "Error: %s failed\n", args[0].c_str());
+	}
+	return succeeded;
+}
@@ -0,0 +1,60 @@
+#ifndef __LATEX_DRIVER_HPP__
+#define __LATEX_DRIVER_HPP__
+
+/*!
+ * \brief Runs LaTeX (and BibTeX/Biber and makeindex) on a file as few times as it takes
+ *
+ * Each program is run directly (not through a shell) with its input from /dev/null and its output
+ * captured, so nothing can stop to prompt for input, and anything that runs too long is killed.
+ * LaTeX runs in nonstop mode.
+ *
+ * After each LaTeX pass, the files it writes for the next pass (.aux, .toc, .lof, .lot and .out)
+ * are hashed, along with the .bbl and .ind files it reads. LaTeX is only run again if one of them changed.
+ * BibTeX (or Biber, for biblatex) is only run if the citations or bibliography databases changed,
+ * and makeindex only if the index entries did.
+ */
+class LatexDriver {
+public:
+	/*!
+	 * \brief Constructor
+	 * \param program The LaTeX program, optionally followed by arguments of its own (e.g. "pdflatex -shell-escape")
+	 * \param timeout How long any one program may run before it is killed, or zero for no limit
+	 * \param verbose True to print what is run and why, along with everything it outputs
+	 */
+	LatexDriver(const std::string& program, std::chrono::seconds timeout, bool verbose);
+
+	/*!
+	 * \brief Has LaTeX (and everything else) write its files to a directory instead of the current one
+	 *
+	 * LaTeX is pointed at it with -output-directory, and it is put first in TEXINPUTS so that
+	 * LaTeX files generated there are found before anything in the current directory.
+	 * BibTeX, Biber and makeindex run in it, with the current directory added to where they look for
+	 * databases and styles.
+	 */
+	void setOutputDirectory(const std::string& dir);
+
+	/*!
+	 * \brief Builds a LaTeX file, in the current directory (or the output directory, if one was set)
+	 * \returns false (after printing what went wrong) if a program failed or timed out
+	 */
+	bool build(const std::string& texFile);
+
+private:
+	static const unsigned int kMaxPasses = 5; //!< Give up on things settling down after this many LaTeX passes
+
+	std::vector<std::string> latexCommand;
+	const std::chrono::seconds timeout;
+	const bool verbose;
+	std::string outputDir; //!< See setOutputDirectory(). Empty for the current directory.
+	std::vector<std::string> environment; //!< The environment programs run with, as NAME=value
+
+	/*!
+	 * \brief Runs a program and waits for it to finish
+	 * \param args The program and its arguments. The program is found in PATH.
+	 * \param dir The directory to run it in, or empty for the current one
+	 * \returns true if it ran and exited successfully
+	 */
+	bool run(const std::vector<std::string>& args, const std::string& dir = std::string());
+};
+
+#endif
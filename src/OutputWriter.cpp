@@ -0,0 +1,156 @@
+#include "precomp.hpp"
+
+#include "OutputWriter.hpp"
+
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#include "Exceptions.hpp"
+#include "InputFile.hpp"
+
+const size_t OutputWriter::kSmallOutput;
+
+OutputFile::OutputFile(const std::string& fn)
+	: filename(fn), descriptor(open(fn.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666))
+{
+	if (descriptor < 0)
+		throw Exceptions::FileException("Error: Could not open output file " + filename, __FUNCTION__);
+}
+
+OutputFile::~OutputFile()
+{
+	close(descriptor);
+}
+
+OutputWriter::OutputWriter(int d, const std::string& n, size_t totalSize)
+	: fd(d), name(n), buffered(totalSize < kSmallOutput), buff(), spans()
+{
+	if (buffered) {
+		buff.reserve(totalSize);
+	}
+	else {
+#ifdef __linux__
+		// Reserve space for the whole output up front so the file system doesn't have to grow the file as we go.
+		// This is only a hint, so failure (e.g. on file systems that don't support it) is fine.
+		fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, totalSize);
+#endif
+	}
+}
+
+void OutputWriter::write(const char* data, size_t len)
+{
+	if (len == 0)
+		return;
+
+	if (buffered) {
+		buff.append(data, len);
+		return;
+	}
+
+	spans.push_back({const_cast<char*>(data), len});
+	if (spans.size() == IOV_MAX)
+		writeSpans();
+}
+
+void OutputWriter::flush()
+{
+	if (buffered) {
+		const char* curr = buff.data();
+		const char* const end = curr + buff.size();
+		while (curr < end) {
+			const ssize_t written = ::write(fd, curr, end - curr);
+			if (written < 0) {
+				if (errno == EINTR)
+					continue;
+				throw Exceptions::FileException("Error: Could not write to output file " + name, __FUNCTION__);
+			}
+			curr += written;
+		}
+		buff.clear();
+	}
+	else {
+		writeSpans();
+	}
+}
+
+void OutputWriter::writeSpans()
+{
+	struct iovec* curr = spans.data();
+	struct iovec* const end = curr + spans.size();
+	while (curr < end) {
+		ssize_t written = writev(fd, curr, end - curr);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			throw Exceptions::FileException("Error: Could not write to output file " + name, __FUNCTION__);
+		}
+
+		// Skip past whatever was written. A short write can leave us in the middle of a span.
+		while (curr < end && static_cast<size_t>(written) >= curr->iov_len) {
+			written -= curr->iov_len;
+			++curr;
+		}
+		if (curr < end) {
+			curr->iov_base = static_cast<char*>(curr->iov_base) + written;
+			curr->iov_len -= written;
+		}
+	}
+	spans.clear();
+}
+
+void OutputWriter::writeWithNewlines(StringView text, StringView newline)
+{
+	const char* curr = text.begin();
+	const char* const end = text.end();
+	while (curr < end) {
+		const char* nl = static_cast<const char*>(memchr(curr, '\n', end - curr));
+		if (nl == nullptr) {
+			write(curr, end - curr);
+			break;
+		}
+		write(curr, nl - curr);
+		write(newline);
+		curr = nl + 1;
+	}
+}
+
+void copyFileContents(const InputFile& from, const OutputFile& to)
+{
+	const size_t size = from.size();
+	size_t copied = 0;
+#ifdef __linux__
+	// Only regular files can be copied from (again) by the kernel. Pipes, etc. have already been drained.
+	if (from.isRegular()) {
+		bool useSendfile = false;
+		while (copied < size) {
+			// Read with explicit offsets so it doesn't matter where the input's file position is
+			loff_t offset = copied;
+			const ssize_t c = useSendfile ? sendfile(to.fd(), from.fd(), &offset, size - copied)
+			                              : copy_file_range(from.fd(), &offset, to.fd(), nullptr, size - copied, 0);
+			if (c > 0) {
+				copied += c;
+			}
+			else if (c < 0 && errno == EINTR) {
+				continue;
+			}
+			else if (!useSendfile && copied == 0) {
+				// copy_file_range isn't supported here (old kernel, across file systems, etc.). Try sendfile.
+				useSendfile = true;
+			}
+			else {
+				break;
+			}
+		}
+	}
+#endif
+	// If the kernel couldn't (fully) do it for us, write out the rest of what we have in memory.
+	if (copied < size) {
+		OutputWriter w(to.fd(), to.name(), size - copied);
+		w.write(from.data() + copied, size - copied);
+		w.flush();
+	}
+}
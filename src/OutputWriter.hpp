@@ -0,0 +1,97 @@
+#ifndef __OUTPUT_WRITER_HPP__
+#define __OUTPUT_WRITER_HPP__
+
+#include <sys/uio.h>
+
+#include "StringView.hpp"
+
+class InputFile;
+
+//! An output file, opened for writing (and truncated) on construction and closed on destruction
+class OutputFile {
+public:
+	/*!
+	 * \brief Opens the file
+	 * \throws FileException if the file could not be opened
+	 */
+	OutputFile(const std::string& filename);
+
+	~OutputFile();
+
+	int fd() const { return descriptor; }
+
+	const std::string& name() const { return filename; }
+
+	// No copy or assignment
+	OutputFile(const OutputFile&) = delete;
+	OutputFile& operator=(const OutputFile&) = delete;
+
+private:
+	const std::string filename;
+	int descriptor;
+};
+
+/*!
+ * \brief Gathers spans of output (unchanged source text and replacements) and writes them with as few
+ *        system calls as possible.
+ *
+ * Spans are not copied, so they must stay valid until flush() is called.
+ * Small outputs are copied into one buffer and written at once.
+ * Larger ones are written straight from where they are with writev.
+ */
+class OutputWriter {
+public:
+	/*!
+	 * \brief Constructor
+	 * \param fd The file descriptor to write to. The writer does not close it.
+	 * \param name The name of what we are writing to, for error messages
+	 * \param totalSize The total number of bytes that will be written (or close to it), or 0 if unknown.
+	 *                  Used to pick a strategy and reserve space for the output.
+	 */
+	OutputWriter(int fd, const std::string& name, size_t totalSize = 0);
+
+	//! Adds a span to the output
+	void write(const char* data, size_t len);
+
+	void write(StringView s) { write(s.data(), s.size()); }
+
+	/*!
+	 * \brief Adds text to the output, replacing each \\n in it with the given newline
+	 *
+	 * Runs of text between newlines are found with memchr and added as spans.
+	 * newline has to stay valid until flush() is called, just like the text.
+	 */
+	void writeWithNewlines(StringView text, StringView newline);
+
+	/*!
+	 * \brief Writes out everything added so far
+	 * \throws FileException on a write error
+	 */
+	void flush();
+
+	// No copy or assignment
+	OutputWriter(const OutputWriter&) = delete;
+	OutputWriter& operator=(const OutputWriter&) = delete;
+
+private:
+	static const size_t kSmallOutput = 64 * 1024; //!< Outputs smaller than this are buffered and written at once
+
+	const int fd;
+	const std::string name;
+	const bool buffered; //!< True if we are copying spans into buff instead of gathering them
+	std::string buff;
+	std::vector<struct iovec> spans;
+
+	//! Writes out spans, handling short writes
+	void writeSpans();
+};
+
+/*!
+ * \brief Copies the contents of an input file to an output file, letting the kernel move the data
+ *        (with copy_file_range or sendfile) where possible.
+ *
+ * Falls back to writing out the input's contents the normal way if the kernel can't do it for us.
+ */
+void copyFileContents(const InputFile& from, const OutputFile& to);
+
+#endif
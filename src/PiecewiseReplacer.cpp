@@ -11,17 +11,13 @@ namespace {
 	const std::string pieceKey = "\\piece";
 }
 
-PiecewiseReplacer::PiecewiseReplacer()
-	: Replacer({"\\begin{piecewise}"})
-{ }
-
-void PiecewiseReplacer::replace(const std::string& matchedKey, Parser& p)
+void PiecewiseReplacer::replace(StringView matchedKey, Parser& p)
 {
 	const char* start = p.curr;
 	p.curr += matchedKey.length();
 
-	std::unique_ptr<MacroOptions> options;
-	decltype(p.parseBracketArgs()) argList;
+	MacroOptions options;
+	ArgList argList;
 	try {
 		options = p.parseMacroOptions();
 		argList = p.parseBracketArgs();
@@ -30,59 +26,64 @@ void PiecewiseReplacer::replace(const std::string& matchedKey, Parser& p)
 		throw Exceptions::InvalidInputException(ex.message + " in " + matchedKey, __FUNCTION__);
 	}
 
-	if (options->opts.size() != 0)
+	if (options.opts.size() != 0)
 		p.errorOnLine(matchedKey + " does not take options");
 
-	if (options->flags.size() != 0)
+	if (options.flags.size() != 0)
 		p.errorOnLine(matchedKey + " does not take flags");
 
-	const size_t numArgs = argList->size();
+	const size_t numArgs = argList.size();
 
 	if (numArgs > 1)
 		p.errorOnLine("Too many arguments for \\begin{piecewise}");
 
 	bool rightBraceSeen = false;
 
-	std::string replacement;
+	ReplacementText replacement(p);
 
-	if (numArgs == 1)
-		replacement += argList->at(0) + " = ";
+	if (numArgs == 1) {
+		replacement.splice(argList[0]);
+		replacement += " = ";
+	}
 
 	replacement += "\\left\\{\\begin{array}{l l}\n";
 
 	while (true) {
 		p.readToNextLineText();
-		if (p.curr >= p.end || std::distance(p.curr, p.end) <= (int)pieceKey.length())
+		if (p.atEnd(p.curr + pieceKey.length()))
 			p.errorOnLine("End of file reached before reaching end of \"piecewise\" definition");
 
-		if (strncmp(p.curr, endKey.c_str(), endKey.length()) == 0) {
+		if (p.lookingAt(endKey)) {
 			p.curr += endKey.length();
 			break;
 		}
-		if (strncmp(p.curr, rbraceKey.c_str(), rbraceKey.length()) == 0) {
+		if (p.lookingAt(rbraceKey)) {
 			if (rightBraceSeen)
 				p.errorOnLine("\"" + rbraceKey + "\" seen twice (only needed once)");
 			rightBraceSeen = true;
 			p.curr += rbraceKey.length();
 			continue;
 		}
-		replacement += parsePiece(p);
+		parsePiece(p, replacement);
 	}
 	replacement += "\\end{array}\\right";
-	replacement += (rightBraceSeen ? "\\}" : ".");
+	if (rightBraceSeen)
+		replacement += "\\}";
+	else
+		replacement += ".";
 
-	p.replacements.emplace_back(start, p.curr, std::move(replacement));
+	p.emit(start, replacement);
 }
 
-std::string PiecewiseReplacer::parsePiece(Parser& p)
+void PiecewiseReplacer::parsePiece(Parser& p, ReplacementText& replacement)
 {
-	if (strncmp(p.curr, pieceKey.c_str(), pieceKey.length()) != 0)
+	if (!p.lookingAt(pieceKey))
 		p.errorOnLine("Expected a \"\\piece\" inside piecewise definition");
 
 	p.curr += pieceKey.length();
 
-	std::unique_ptr<MacroOptions> options;
-	decltype(p.parseBracketArgs()) argList;
+	MacroOptions options;
+	ArgList argList;
 	try {
 		options = p.parseMacroOptions();
 		argList = p.parseBracketArgs();
@@ -91,13 +92,13 @@ std::string PiecewiseReplacer::parsePiece(Parser& p)
 		throw Exceptions::InvalidInputException(ex.message + " in " + pieceKey, __FUNCTION__);
 	}
 
-	if (options->opts.size() != 0)
+	if (options.opts.size() != 0)
 		p.errorOnLine(pieceKey + " does not take options");
 
-	if (options->flags.size() != 0)
+	if (options.flags.size() != 0)
 		p.errorOnLine(pieceKey + " does not take flags");
 
-	const size_t numArgs = argList->size();
+	const size_t numArgs = argList.size();
 
 	if (numArgs < 1)
 		p.errorOnLine(pieceKey + " needs at least one argument");
@@ -105,14 +106,14 @@ std::string PiecewiseReplacer::parsePiece(Parser& p)
 	if (numArgs > 2)
 		p.errorOnLine(pieceKey + " only takes one or two arguments");
 
-	std::string piece = "\t";
-
-	piece += argList->at(0) + ", & ";
+	replacement += "\t";
+	replacement.splice(argList[0]);
+	replacement += ", & ";
 
-	if (numArgs == 2)
-		piece += argList->at(1) + " ";
-
-	piece += "\\\\\n";
+	if (numArgs == 2) {
+		replacement.splice(argList[1]);
+		replacement += " ";
+	}
 
-	return piece;
+	replacement += "\\\\\n";
 }
@@ -3,16 +3,23 @@
 
 #include "Replacer.hpp"
 
+class ReplacementText;
+
 class PiecewiseReplacer final : public Replacer {
 public:
-	PiecewiseReplacer();
+	void replace(StringView matchedKey, Parser& p) override;
+
+	size_t numKeys() const override { return 1; }
 
-	void replace(const std::string& matchedKey, Parser& p) override;
+	StringView key(size_t) const override { return "\\begin{piecewise}"; }
 
 	bool shouldRecurse() const override { return true; }
 
+	unsigned int modes() const override { return Math; }
+
 private:
-	static std::string parsePiece(Parser& p);
+	//! Parses a \\piece and adds it to the replacement
+	static void parsePiece(Parser& p, ReplacementText& replacement);
 };
 
 #endif
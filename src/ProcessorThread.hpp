@@ -1,30 +0,0 @@
-#ifndef __PROCESSOR_THREAD_HPP__
-#define __PROCESSOR_THREAD_HPP__
-
-class Context;
-
-//! Processes files in an additional thread
-class ProcessorThread {
-public:
-	static const std::chrono::milliseconds dequeueTimeout;
-
-	ProcessorThread(Context& context);
-
-	bool isBusy() const { return busy; }
-
-	//! Tells thread to finish its current file and close
-	void beginExit();
-
-	//! Closes the thread as soon as it is done processing 
-	void join();
-
-private:
-	std::atomic_bool exit; //!< Raised by join
-	std::atomic_bool busy; //!< True when processing a file, false when waiting for one to process.
-	Context& ctxt;
-	std::thread t;
-
-	void threadProc();
-};
-
-#endif
@@ -1,46 +1,63 @@
 #ifndef __REPLACER_HPP__
 #define __REPLACER_HPP__
 
+#include "StringView.hpp"
+
 class Parser;
 
-//! Abstract base class for replacement generators
+/*!
+ * \brief Abstract base class for replacement generators
+ *
+ * Replacers hold no state of their own, and their keys are constants, so the built-in ones
+ * are constructed at compile time and cost nothing at startup.
+ */
 class Replacer {
 public:
-
-	/*!
-	 * \brief Constructor. Assumes the base class's constructor will fill the key list later
-	 * \see DirectReplacer as an example
-	 */
-	Replacer() : keySet(std::greater<std::string>()) { }
-
-	//! Constructor. Takes a list of keys to initialize keySet with
-	Replacer(std::initializer_list<std::string> keys)
-		: keySet(keys, std::greater<std::string>())
-	{ }
+	//! Where in a document keys are matched (see modes())
+	enum Mode : unsigned int {
+		Text = 1 << 0, //!< Running text
+		Math = 1 << 1, //!< Between $s, in \\[...\\] or \\(...\\), or in an equation, align, etc. environment
+		AnyMode = Text | Math
+	};
 
 	virtual ~Replacer() { }
 
 	/*!
 	 * \brief Performs a replacement, or does nothing
-	 * \param matchedKey the key from Replacer::getKeys that was matched
-	 * \param p Parser for the current file (or replacement, in the case of recursion)
+	 * \param matchedKey the key from Replacer::key that was matched
+	 * \param p Parser for the current file
 	 */
-	virtual void replace(const std::string& matchedKey, Parser& p) = 0;
+	virtual void replace(StringView matchedKey, Parser& p) = 0;
+
+	//! Returns the number of tokens that should start a replacement of this type (see key())
+	virtual size_t numKeys() const = 0;
 
 	/*!
-	 * \brief Gets a list of tokens that should start a replacement of this type
+	 * \brief Gets one of the tokens that should start a replacement of this type
 	 *
-	 * Constructors should initialize keySet to whatever they want
+	 * The view points at storage that outlives the replacer (usually a string literal).
 	 */
-	const std::set<std::string, std::greater<std::string>>& getKeys() const { return keySet; };
+	virtual StringView key(size_t i) const = 0;
 
-	//! Returns true if the generated replacement can contain replacements itself
+	//! Returns true if macros in source text spliced into the generated replacement should be expanded
 	virtual bool shouldRecurse() const = 0;
 
-protected:
-	std::set<std::string, std::greater<std::string>> keySet;
+	/*!
+	 * \brief Returns true if the replacement depends on nothing but the text of the invocation
+	 *        (its key, options and arguments), so that it can be cached (see ExpansionCache)
+	 *
+	 * A pure replacer must not do anything besides making its replacement and issuing warnings.
+	 * (Expansions that issue warnings aren't cached, so that every occurrence still warns.)
+	 */
+	virtual bool isPure() const { return false; }
 
-private:
+	/*!
+	 * \brief Returns the modes (Mode flags) the replacer's keys are matched in
+	 *
+	 * The parser only looks for the keys of replacers that apply in the mode it is in,
+	 * so a replacer that makes math shouldn't be tried (or rewrite things) in running text.
+	 */
+	virtual unsigned int modes() const { return AnyMode; }
 };
 
 #endif
@@ -0,0 +1,57 @@
+#ifndef __SMALL_LIST_HPP__
+#define __SMALL_LIST_HPP__
+
+#include "Arena.hpp"
+
+/*!
+ * \brief A list that stores its first few items inline, spilling into an Arena if it grows past them
+ *
+ * Meant for trivially copyable items (such as StringViews) that only need to live as long as the arena's
+ * current contents. Copies are shallow: a copy of a list that has spilled shares its spilled items.
+ */
+template <typename T, size_t N>
+class SmallList {
+public:
+	explicit SmallList(Arena* a = nullptr)
+		: inlineItems(), spill(nullptr), count(0), capacity(N), arena(a)
+	{ }
+
+	void push_back(const T& item)
+	{
+		if (count == capacity)
+			grow();
+		data()[count++] = item;
+	}
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	T& operator[](size_t i) { return data()[i]; }
+	const T& operator[](size_t i) const { return data()[i]; }
+
+	T* begin() { return data(); }
+	T* end() { return data() + count; }
+	const T* begin() const { return data(); }
+	const T* end() const { return data() + count; }
+
+private:
+	T inlineItems[N];
+	T* spill; //!< Items in the arena once we've outgrown inlineItems, otherwise null
+	size_t count;
+	size_t capacity;
+	Arena* arena;
+
+	T* data() { return spill != nullptr ? spill : inlineItems; }
+	const T* data() const { return spill != nullptr ? spill : inlineItems; }
+
+	void grow()
+	{
+		assert(arena != nullptr);
+		T* bigger = static_cast<T*>(arena->allocate(sizeof(T) * capacity * 2, alignof(T)));
+		std::copy(data(), data() + count, bigger);
+		spill = bigger;
+		capacity *= 2;
+	}
+};
+
+#endif
@@ -0,0 +1,174 @@
+#include "precomp.hpp"
+
+#include "Stats.hpp"
+
+#include <sys/resource.h>
+
+namespace {
+	//! Quotes a string for JSON
+	std::string jsonQuoted(const std::string& s)
+	{
+		std::string ret = "\"";
+		for (char c : s) {
+			if (c == '"' || c == '\\') {
+				ret += '\\';
+				ret += c;
+			}
+			else if (static_cast<unsigned char>(c) < 0x20) {
+				char escaped[8];
+				snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+				ret += escaped;
+			}
+			else {
+				ret += c;
+			}
+		}
+		return ret + "\"";
+	}
+
+	//! Returns a file's replacer keys, most time-consuming first
+	std::vector<const FileStats::KeyStats*> sortedKeys(const FileStats& fs)
+	{
+		std::vector<const FileStats::KeyStats*> ret;
+		for (const auto& kv : fs.keys)
+			ret.push_back(&kv.second);
+		std::sort(ret.begin(), ret.end(), [](const FileStats::KeyStats* a, const FileStats::KeyStats* b) {
+			return a->seconds != b->seconds ? a->seconds > b->seconds : a->key < b->key;
+		});
+		return ret;
+	}
+
+	//! Writes a file's stats as a JSON object
+	void printFileJson(FILE* out, const FileStats& fs)
+	{
+		fprintf(out, "\"cached\": %s, \"bytes_in\": %llu, \"bytes_out\": %llu, \"seconds\": {",
+		        fs.cached ? "true" : "false", static_cast<unsigned long long>(fs.bytesIn),
+		        static_cast<unsigned long long>(fs.bytesOut));
+		for (int p = 0; p < FileStats::NumPhases; ++p) {
+			fprintf(out, "%s\"%s\": %.6f", p == 0 ? "" : ", ", FileStats::phaseName(static_cast<FileStats::Phase>(p)),
+			        fs.seconds[p]);
+		}
+		fprintf(out, "}, \"keys\": {");
+		bool first = true;
+		for (const FileStats::KeyStats* k : sortedKeys(fs)) {
+			fprintf(out, "%s%s: {\"matches\": %zu, \"seconds\": %.6f}", first ? "" : ", ", jsonQuoted(k->key.str()).c_str(),
+			        k->matches, k->seconds);
+			first = false;
+		}
+		fprintf(out, "}");
+	}
+}
+
+const char* FileStats::phaseName(Phase p)
+{
+	switch (p) {
+		case Read: return "read";
+		case Parse: return "parse";
+		case Recursion: return "recursion";
+		case Write: return "write";
+		case NumPhases: break;
+	}
+	return "unknown";
+}
+
+void FileStats::add(const FileStats& o)
+{
+	bytesIn += o.bytesIn;
+	bytesOut += o.bytesOut;
+	for (size_t p = 0; p < seconds.size(); ++p)
+		seconds[p] += o.seconds[p];
+	for (const auto& kv : o.keys) {
+		KeyStats& k = key(kv.second.key);
+		k.matches += kv.second.matches;
+		k.seconds += kv.second.seconds;
+	}
+}
+
+void Stats::addFile(const std::string& name, const FileStats& fs)
+{
+	std::lock_guard<std::mutex> lock(filesMutex);
+	files.emplace_back(name, fs);
+}
+
+void Stats::clear()
+{
+	std::lock_guard<std::mutex> lock(filesMutex);
+	files.clear();
+	latexSeconds = 0;
+}
+
+void Stats::print(FILE* out, Format f) const
+{
+	std::lock_guard<std::mutex> lock(filesMutex);
+
+	FileStats total;
+	for (const auto& file : files)
+		total.add(file.second);
+
+	struct rusage usage;
+	const long peakRssKiB = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : -1;
+
+	if (f == Format::Json)
+		printJson(out, total, peakRssKiB);
+	else
+		printText(out, total, peakRssKiB);
+}
+
+void Stats::printText(FILE* out, const FileStats& total, long peakRssKiB) const
+{
+	size_t nameWidth = strlen("Total");
+	for (const auto& file : files)
+		nameWidth = std::max(nameWidth, file.first.size());
+	const int w = static_cast<int>(nameWidth);
+
+	fprintf(out, "\n%-*s %10s %10s %9s %9s %9s %9s\n", w, "File", "In (KB)", "Out (KB)", "Read ms", "Parse ms",
+	        "Recur ms", "Write ms");
+	const auto row = [&](const std::string& name, const FileStats& fs) {
+		fprintf(out, "%-*s %10.1f %10.1f %9.2f %9.2f %9.2f %9.2f%s\n", w, name.c_str(), fs.bytesIn / 1e3,
+		        fs.bytesOut / 1e3, fs.seconds[FileStats::Read] * 1e3, fs.seconds[FileStats::Parse] * 1e3,
+		        fs.seconds[FileStats::Recursion] * 1e3, fs.seconds[FileStats::Write] * 1e3,
+		        fs.cached ? "  (cached)" : "");
+	};
+	for (const auto& file : files)
+		row(file.first, file.second);
+	row("Total", total);
+
+	const std::vector<const FileStats::KeyStats*> keys = sortedKeys(total);
+	if (!keys.empty()) {
+		size_t keyWidth = strlen("Replacer key");
+		for (const FileStats::KeyStats* k : keys)
+			keyWidth = std::max(keyWidth, k->key.size());
+		const int kw = static_cast<int>(keyWidth);
+
+		fprintf(out, "\n%-*s %10s %12s %12s\n", kw, "Replacer key", "Matches", "replace ms", "ns/match");
+		for (const FileStats::KeyStats* k : keys) {
+			fprintf(out, "%-*s %10zu %12.2f %12.0f\n", kw, k->key.str().c_str(), k->matches, k->seconds * 1e3,
+			        k->seconds * 1e9 / k->matches);
+		}
+	}
+
+	if (!workerWaitSeconds.empty()) {
+		fprintf(out, "\n%-16s %12s\n", "Worker", "Waiting ms");
+		for (size_t i = 0; i < workerWaitSeconds.size(); ++i)
+			fprintf(out, "%-16zu %12.2f\n", i, workerWaitSeconds[i] * 1e3);
+	}
+
+	fprintf(out, "\nLaTeX: %.2f ms\n", latexSeconds * 1e3);
+	fprintf(out, "Peak resident memory: %ld KiB\n", peakRssKiB);
+}
+
+void Stats::printJson(FILE* out, const FileStats& total, long peakRssKiB) const
+{
+	fprintf(out, "{\n\t\"files\": [");
+	for (size_t i = 0; i < files.size(); ++i) {
+		fprintf(out, "%s\n\t\t{\"name\": %s, ", i == 0 ? "" : ",", jsonQuoted(files[i].first).c_str());
+		printFileJson(out, files[i].second);
+		fprintf(out, "}");
+	}
+	fprintf(out, "\n\t],\n\t\"total\": {");
+	printFileJson(out, total);
+	fprintf(out, "},\n\t\"worker_wait_seconds\": [");
+	for (size_t i = 0; i < workerWaitSeconds.size(); ++i)
+		fprintf(out, "%s%.6f", i == 0 ? "" : ", ", workerWaitSeconds[i]);
+	fprintf(out, "],\n\t\"latex_seconds\": %.6f,\n\t\"peak_rss_kib\": %ld\n}\n", latexSeconds, peakRssKiB);
+}
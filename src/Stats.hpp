@@ -0,0 +1,126 @@
+#ifndef __STATS_HPP__
+#define __STATS_HPP__
+
+#include "StringView.hpp"
+
+//! Timings and counts for processing one file (or, once they are added up, several)
+struct FileStats {
+	//! The phases of processing a file that are timed
+	enum Phase {
+		Read, //!< Mapping or reading the file in
+		Parse, //!< Parsing it, including making replacements and recursion
+		Recursion, //!< Expanding macros spliced into replacements (see Parser::expandQueued)
+		Write, //!< Writing out the LaTeX file
+		NumPhases
+	};
+
+	//! Returns the name of a phase (e.g. "read")
+	static const char* phaseName(Phase p);
+
+	//! What one replacer key was used for
+	struct KeyStats {
+		StringView key;
+		size_t matches;
+		double seconds; //!< Time spent in Replacer::replace for this key
+	};
+
+	bool cached; //!< True if the file was skipped thanks to the build cache (see BuildCache)
+	uint64_t bytesIn;
+	uint64_t bytesOut;
+	std::array<double, NumPhases> seconds;
+	//! Keyed by the address of each key's text, which the replacers own and never move
+	std::unordered_map<const char*, KeyStats> keys;
+
+	FileStats() : cached(false), bytesIn(0), bytesOut(0), seconds(), keys() { }
+
+	//! Returns the stats for a replacer key, adding them if they're new
+	KeyStats& key(StringView k)
+	{
+		auto it = keys.find(k.data());
+		if (it == keys.end())
+			it = keys.emplace(k.data(), KeyStats{k, 0, 0}).first;
+		return it->second;
+	}
+
+	//! Adds another file's (or a piece of this file's) stats to these
+	void add(const FileStats& o);
+};
+
+/*!
+ * \brief Adds the time between its construction and stop() (or its destruction) to a counter
+ *
+ * Does nothing (and doesn't even read the clock) if it isn't given a counter,
+ * so timing can be left in place when nobody asked for stats.
+ */
+class PhaseTimer {
+public:
+	explicit PhaseTimer(double* c)
+		: counter(c), start(c != nullptr ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point())
+	{ }
+
+	//! Times a phase of processing a file, if s isn't nullptr
+	PhaseTimer(FileStats* s, FileStats::Phase p) : PhaseTimer(s != nullptr ? &s->seconds[p] : nullptr) { }
+
+	~PhaseTimer() { stop(); }
+
+	void stop()
+	{
+		if (counter == nullptr)
+			return;
+		*counter += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		counter = nullptr;
+	}
+
+	// No copy or assignment
+	PhaseTimer(const PhaseTimer&) = delete;
+	PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+private:
+	double* counter;
+	std::chrono::steady_clock::time_point start;
+};
+
+/*!
+ * \brief Collects the stats of every file processed (see --stats), along with how long LaTeX and
+ *        the worker pool spent, and reports them as a table or as JSON
+ */
+class Stats {
+public:
+	//! How to report stats
+	enum class Format {
+		Text,
+		Json
+	};
+
+	Stats() : filesMutex(), files(), latexSeconds(0), workerWaitSeconds() { }
+
+	//! Adds a file's stats. Can be called from any thread.
+	void addFile(const std::string& name, const FileStats& fs);
+
+	void addLatexTime(double seconds) { latexSeconds += seconds; }
+
+	//! Sets how long each of the pool's workers has spent waiting for work (see WorkerPool::waitSeconds)
+	void setWorkerWaits(std::vector<double>&& seconds) { workerWaitSeconds = std::move(seconds); }
+
+	//! Reports everything, with totals and the process's peak resident memory
+	void print(FILE* out, Format f) const;
+
+	//! Forgets everything, before another build (see --watch)
+	void clear();
+
+	// No copy or assignment
+	Stats(const Stats&) = delete;
+	Stats& operator=(const Stats&) = delete;
+
+private:
+	mutable std::mutex filesMutex;
+	std::vector<std::pair<std::string, FileStats>> files; //!< In the order they finished
+	double latexSeconds;
+	std::vector<double> workerWaitSeconds;
+
+	void printText(FILE* out, const FileStats& total, long peakRssKiB) const;
+
+	void printJson(FILE* out, const FileStats& total, long peakRssKiB) const;
+};
+
+#endif
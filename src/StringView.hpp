@@ -0,0 +1,79 @@
+#ifndef __STRING_VIEW_HPP__
+#define __STRING_VIEW_HPP__
+
+/*!
+ * \brief A non-owning view of a run of characters (usually in a file buffer or a string literal)
+ *
+ * The viewed characters must outlive the view.
+ */
+class StringView {
+public:
+	constexpr StringView() : d(nullptr), n(0) { }
+
+	constexpr StringView(const char* data, size_t length) : d(data), n(length) { }
+
+	StringView(const char* first, const char* last) : d(first), n(last - first) { }
+
+	//! Views a string literal (without its null terminator)
+	template <size_t N>
+	constexpr StringView(const char (&literal)[N]) : d(literal), n(N - 1) { }
+
+	StringView(const std::string& s) : d(s.data()), n(s.size()) { }
+
+	constexpr const char* data() const { return d; }
+	constexpr size_t size() const { return n; }
+	constexpr size_t length() const { return n; }
+	constexpr bool empty() const { return n == 0; }
+
+	constexpr const char* begin() const { return d; }
+	constexpr const char* end() const { return d + n; }
+
+	constexpr char operator[](size_t i) const { return d[i]; }
+
+	//! Copies the viewed characters into a std::string
+	std::string str() const { return std::string(d, n); }
+
+	int compare(const StringView& o) const
+	{
+		const int c = n == 0 || o.n == 0 ? 0 : memcmp(d, o.d, std::min(n, o.n));
+		if (c != 0)
+			return c;
+		return n < o.n ? -1 : (n > o.n ? 1 : 0);
+	}
+
+	bool operator==(const StringView& o) const { return n == o.n && (n == 0 || memcmp(d, o.d, n) == 0); }
+	bool operator!=(const StringView& o) const { return !(*this == o); }
+	bool operator<(const StringView& o) const { return compare(o) < 0; }
+
+private:
+	const char* d;
+	size_t n;
+};
+
+// Allow views to be concatenated with strings for building messages and replacements
+
+inline std::string operator+(std::string lhs, const StringView& rhs) { return lhs.append(rhs.data(), rhs.size()); }
+
+inline std::string operator+(const char* lhs, const StringView& rhs) { return std::string(lhs) + rhs; }
+
+inline std::string operator+(const StringView& lhs, const std::string& rhs) { return lhs.str() + rhs; }
+
+inline std::string operator+(const StringView& lhs, const char* rhs) { return lhs.str() + rhs; }
+
+namespace std {
+	template <>
+	struct hash<StringView> {
+		//! FNV-1a, which does well on the short keys we hash
+		size_t operator()(const StringView& s) const
+		{
+			uint64_t h = 14695981039346656037ULL;
+			for (char c : s) {
+				h ^= static_cast<unsigned char>(c);
+				h *= 1099511628211ULL;
+			}
+			return static_cast<size_t>(h);
+		}
+	};
+}
+
+#endif
@@ -6,11 +6,17 @@
 //! Replaces \\summ{args} with a properly formatted LaTeX summation
 class SummationReplacer final : public Replacer {
 public:
-	SummationReplacer();
+	void replace(StringView matchedKey, Parser& p) override;
 
-	void replace(const std::string& matchedKey, Parser& p) override;
+	size_t numKeys() const override { return 1; }
+
+	StringView key(size_t) const override { return "\\summ"; }
 
 	bool shouldRecurse() const override { return true; }
+
+	bool isPure() const override { return true; }
+
+	unsigned int modes() const override { return Math; }
 };
 
 #endif
@@ -0,0 +1,227 @@
+#include "precomp.hpp"
+
+#include "TableReplacer.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "BuildCache.hpp"
+#include "Exceptions.hpp"
+#include "FileParser.hpp"
+#include "IncludeGraph.hpp"
+
+namespace {
+	//! Identifies an image, and its layout. Bump the number whenever the layout changes.
+	const char kMagic[8] = {'s', 'e', 'm', 't', 'b', 'l', '0', '1'};
+
+	/*!
+	 * \brief The start of a compiled image
+	 *
+	 * It is followed by the trie's states, then its edges, then the entries, then the strings.
+	 * Everything is in native byte order, since images are only a cache for the machine that made them.
+	 */
+	struct ImageHeader {
+		char magic[8];
+		uint32_t numStates;
+		uint32_t numEdges;
+		uint32_t numEntries;
+		uint32_t longestKey;
+		uint64_t stringsSize;
+		uint64_t configSize; //!< The stamp of the config file the image was compiled from
+		int64_t configMtime; //!< (0 if it was too recent to trust, so the image is recompiled. See FileStamp::trustedMtime())
+		uint64_t configPathHash; //!< The hash of its canonical path
+		uint32_t rootNext[256];
+	};
+
+	uint64_t hashPath(const std::string& path)
+	{
+		const std::string canonical = IncludeGraph::canonicalPath(path);
+		return hashBytes(canonical.data(), canonical.size());
+	}
+
+	//! Returns the size of the image described by a header
+	size_t imageSize(const ImageHeader& h, size_t entrySize)
+	{
+		return sizeof(ImageHeader) + h.numStates * sizeof(KeyTrie::State) + h.numEdges * sizeof(KeyTrie::Edge)
+		       + h.numEntries * entrySize + h.stringsSize;
+	}
+
+	//! Appends the bytes of a plain struct (or array of them) to an image
+	template <typename T>
+	void append(std::string& image, const T* data, size_t count)
+	{
+		image.append(reinterpret_cast<const char*>(data), count * sizeof(T));
+	}
+}
+
+TableReplacer::TableReplacer(const std::string& config, const std::string& image, const std::string& textTriggers,
+                             const std::string& mathTriggers, bool verbose)
+	: Replacer(), mapping(nullptr), mappingSize(0), trie(), entries(nullptr), numEntries(0), strings(nullptr),
+	  longestKey(0), configFingerprint(0), textScanner(textTriggers), mathScanner(mathTriggers)
+{
+	if (!map(config, image, true)) {
+		if (verbose)
+			printf("Compiling replacement tables in %s...\n", config.c_str());
+		compile(config, image);
+		if (!map(config, image, false))
+			throw Exceptions::FileException("Error: Could not load compiled replacement tables " + image, __FUNCTION__);
+	}
+	// Table keys apply in any mode
+	const std::string firstBytes = KeyTrie::firstBytes(trie.rootNext);
+	textScanner = TriggerScanner(textTriggers + firstBytes);
+	mathScanner = TriggerScanner(mathTriggers + firstBytes);
+
+	if (verbose)
+		printf("Loaded %zu replacements from %s\n", numEntries, config.c_str());
+}
+
+TableReplacer::~TableReplacer()
+{
+	if (mapping != nullptr)
+		munmap(const_cast<void*>(mapping), mappingSize);
+}
+
+void TableReplacer::replace(StringView matchedKey, Parser& p)
+{
+	const char* start = p.curr;
+	p.curr += matchedKey.length();
+
+	// The replacement follows its key in the image (see compile())
+	const char* const replacement = matchedKey.end();
+	p.emit(start, StringView(replacement, strlen(replacement)));
+}
+
+bool TableReplacer::map(const std::string& config, const std::string& image, bool checkConfig)
+{
+	const int fd = open(image.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	void* m = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(ImageHeader))
+		m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // The mapping keeps the file open
+	if (m == MAP_FAILED)
+		return false;
+
+	const size_t size = st.st_size;
+	const ImageHeader& h = *static_cast<const ImageHeader*>(m);
+	const FileStamp stamp = checkConfig ? FileStamp::of(config) : FileStamp();
+	if (memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 || imageSize(h, sizeof(Entry)) != size
+	    || (checkConfig && (h.configSize != stamp.size || h.configMtime != stamp.mtime
+	                        || h.configPathHash != hashPath(config)))) {
+		munmap(m, size);
+		return false;
+	}
+
+	if (mapping != nullptr)
+		munmap(const_cast<void*>(mapping), mappingSize);
+	mapping = m;
+	mappingSize = size;
+
+	const char* at = static_cast<const char*>(m) + sizeof(ImageHeader);
+	const KeyTrie::State* states = reinterpret_cast<const KeyTrie::State*>(at);
+	at += h.numStates * sizeof(KeyTrie::State);
+	const KeyTrie::Edge* edges = reinterpret_cast<const KeyTrie::Edge*>(at);
+	at += h.numEdges * sizeof(KeyTrie::Edge);
+	trie = {states, edges, h.rootNext};
+	entries = reinterpret_cast<const Entry*>(at);
+	numEntries = h.numEntries;
+	at += h.numEntries * sizeof(Entry);
+	strings = at;
+	longestKey = h.longestKey;
+	configFingerprint = hashBytes(reinterpret_cast<const char*>(&h.configSize),
+	                              sizeof(h.configSize) + sizeof(h.configMtime) + sizeof(h.configPathHash));
+	return true;
+}
+
+void TableReplacer::compile(const std::string& config, const std::string& image)
+{
+	const FileStamp stamp = FileStamp::of(config);
+	std::ifstream in(config);
+	if (!stamp.exists || !in)
+		throw Exceptions::FileException("Error: Could not open config file " + config, __FUNCTION__);
+
+	// If a key is given more than once, the last one wins
+	std::map<std::string, std::string> table;
+	std::string line;
+	for (int lineNumber = 1; std::getline(in, line); ++lineNumber) {
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		boost::trim(line);
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		const auto error = [&](const std::string& msg) {
+			std::stringstream err;
+			err << config << ":" << lineNumber << ": error: " << msg;
+			throw Exceptions::InvalidInputException(err.str(), __FUNCTION__);
+		};
+
+		const size_t directiveEnd = line.find_first_of(" \t");
+		const std::string directive = line.substr(0, directiveEnd);
+		if (directive != "replace")
+			error("Unknown directive \"" + directive + "\"");
+
+		const size_t keyStart = line.find_first_not_of(" \t", directiveEnd);
+		const size_t keyEnd = line.find_first_of(" \t", keyStart);
+		if (keyStart == std::string::npos || keyEnd == std::string::npos)
+			error("replace needs a key and what to replace it with");
+		table[line.substr(keyStart, keyEnd - keyStart)] = line.substr(line.find_first_not_of(" \t", keyEnd));
+	}
+
+	// The map keeps the keys sorted, as the trie needs them
+	std::vector<StringView> keys;
+	keys.reserve(table.size());
+	size_t keyBytes = 0;
+	size_t longest = 0;
+	for (const auto& kv : table) {
+		keys.emplace_back(kv.first);
+		keyBytes += kv.first.size();
+		longest = std::max(longest, kv.first.size());
+	}
+	std::vector<KeyTrie::State> states(keyBytes + 1);
+	std::vector<KeyTrie::Edge> edges(keyBytes);
+	uint32_t rootNext[256];
+	states.resize(KeyTrie::build([&](size_t i) { return keys[i]; }, keys.size(), states.data(), edges.data(),
+	                             rootNext));
+	edges.resize(states.size() - 1);
+
+	// Each key is followed by its replacement and a null, so replace() can find it from the key alone
+	std::vector<Entry> tableEntries;
+	std::string tableStrings;
+	tableEntries.reserve(table.size());
+	for (const auto& kv : table) {
+		tableEntries.push_back({static_cast<uint32_t>(tableStrings.size()), static_cast<uint32_t>(kv.first.size())});
+		tableStrings += kv.first;
+		tableStrings += kv.second;
+		tableStrings += '\0';
+	}
+
+	ImageHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, kMagic, sizeof(kMagic));
+	h.numStates = static_cast<uint32_t>(states.size());
+	h.numEdges = static_cast<uint32_t>(edges.size());
+	h.numEntries = static_cast<uint32_t>(tableEntries.size());
+	h.longestKey = static_cast<uint32_t>(longest);
+	h.stringsSize = tableStrings.size();
+	h.configSize = stamp.size;
+	h.configMtime = stamp.trustedMtime(FileStamp::now());
+	h.configPathHash = hashPath(config);
+	std::copy(rootNext, rootNext + 256, h.rootNext);
+
+	std::string bytes;
+	bytes.reserve(imageSize(h, sizeof(Entry)));
+	append(bytes, &h, 1);
+	append(bytes, states.data(), states.size());
+	append(bytes, edges.data(), edges.size());
+	append(bytes, tableEntries.data(), tableEntries.size());
+	bytes += tableStrings;
+
+	// Put it in place whole, so nobody maps half an image
+	replaceFile(image, bytes, "compiled replacement tables");
+}
@@ -0,0 +1,107 @@
+#ifndef __TABLE_REPLACER_HPP__
+#define __TABLE_REPLACER_HPP__
+
+#include "KeyTrie.hpp"
+#include "Replacer.hpp"
+#include "TriggerScanner.hpp"
+
+/*!
+ * \brief Makes direct swaps (like DirectReplacer) from tables in a project's config file (semtex.conf)
+ *
+ * Each line of the config file is a directive. Blank lines and lines starting with # are ignored.
+ *
+ *     # Our shorthands
+ *     replace \R \mathbb{R}
+ *     replace ~= \approx
+ *
+ * The key runs up to the first space, and the replacement is the rest of the line.
+ * Table keys are matched in running text and math alike (see Replacer::modes()).
+ *
+ * Tables can run to thousands of keys, so they aren't parsed on every run.
+ * They are compiled once into an image holding their trie (see KeyTrie) and strings,
+ * which later runs map straight into memory and search in place.
+ * Loading a table therefore takes the same time however big it is.
+ * The image is recompiled whenever the config file changes.
+ *
+ * The parser looks its keys up with match(), alongside the KeyMatcher built from the other replacers.
+ */
+class TableReplacer final : public Replacer {
+public:
+	/*!
+	 * \brief Maps in the image compiled from a config file, compiling it first if it is missing or out of date
+	 * \param config The config file
+	 * \param image Where the compiled image is kept
+	 * \param textTriggers Bytes the parser stops on in running text besides the first bytes of our keys
+	 *                     (see triggers())
+	 * \param mathTriggers The same, in math
+	 * \throws InvalidInputException if the config file has errors
+	 * \throws FileException if the config file can't be read, or the image can't be written or read
+	 */
+	TableReplacer(const std::string& config, const std::string& image, const std::string& textTriggers,
+	              const std::string& mathTriggers, bool verbose);
+
+	~TableReplacer();
+
+	/*!
+	 * \brief Finds the longest key in the tables that starts at curr
+	 * \returns The key (which views the image), or an empty view if none matches
+	 */
+	StringView match(const char* curr, const char* end) const
+	{
+		const uint32_t e = KeyTrie::match(trie, curr, end);
+		if (e == KeyTrie::kNoEntry)
+			return StringView();
+		return key(e);
+	}
+
+	void replace(StringView matchedKey, Parser& p) override;
+
+	size_t numKeys() const override { return numEntries; }
+
+	StringView key(size_t i) const override { return StringView(strings + entries[i].keyOffset, entries[i].keyLength); }
+
+	bool shouldRecurse() const override { return false; }
+
+	//! The bytes the parser should stop on in a mode: the first bytes of our keys, plus the ones it was given
+	const TriggerScanner& triggers(Mode mode) const { return mode == Math ? mathScanner : textScanner; }
+
+	//! Returns the length of the longest key
+	size_t maxKeyLength() const { return longestKey; }
+
+	//! Identifies the config file (and version of it) the tables were compiled from
+	uint64_t fingerprint() const { return configFingerprint; }
+
+	// No copy or assignment
+	TableReplacer(const TableReplacer&) = delete;
+	TableReplacer& operator=(const TableReplacer&) = delete;
+
+private:
+	//! Where a key is in the image's strings. Its replacement follows it, and is null-terminated.
+	struct Entry {
+		uint32_t keyOffset;
+		uint32_t keyLength;
+	};
+
+	const void* mapping;
+	size_t mappingSize;
+	KeyTrie::View trie;
+	const Entry* entries;
+	size_t numEntries;
+	const char* strings;
+	size_t longestKey;
+	uint64_t configFingerprint;
+	TriggerScanner textScanner;
+	TriggerScanner mathScanner;
+
+	/*!
+	 * \brief Maps in the image
+	 * \param checkConfig True to check that it was compiled from config as it is now
+	 * \returns false if it is missing, from another version of SemTeX, or (if checked) out of date
+	 */
+	bool map(const std::string& config, const std::string& image, bool checkConfig);
+
+	//! Compiles the tables in config into image
+	static void compile(const std::string& config, const std::string& image);
+};
+
+#endif
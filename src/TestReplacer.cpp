@@ -5,33 +5,29 @@
 #include "Exceptions.hpp"
 #include "FileParser.hpp"
 
-TestReplacer::TestReplacer()
-	: Replacer({"\\test"})
-{ }
-
-void TestReplacer::replace(const std::string& matchedKey, Parser& p)
+void TestReplacer::replace(StringView matchedKey, Parser& p)
 {
 	const char* start = p.curr;
 	p.curr += matchedKey.length();
 
-	std::unique_ptr<MacroOptions> options;
-	decltype(parseBracketArgs(pi)) argList;
+	MacroOptions options;
+	ArgList argList;
 	try {
-		options = parseMacroOptions(pi);
-		argList = parseBracketArgs(pi);
+		options = p.parseMacroOptions();
+		argList = p.parseBracketArgs();
 	}
 	catch (const Exceptions::InvalidInputException& ex) {
 		throw Exceptions::InvalidInputException(ex.message + " in \\test", __FUNCTION__);
 	}
 
-	for (const auto& opt : options->opts)
-		printf("Option: %s=%s\n", opt.first.c_str(), opt.second.c_str());
+	for (const auto& opt : options.opts)
+		printf("Option: %.*s=%.*s\n", (int)opt.name.size(), opt.name.data(), (int)opt.value.size(), opt.value.data());
 
-	for (const auto& flag : options->flags)
-		printf("Flag: %s\n", flag.c_str());
+	for (const auto& flag : options.flags)
+		printf("Flag: %.*s\n", (int)flag.size(), flag.data());
 
-	for (const auto& arg : *argList)
-		printf("Arg: %s\n", arg.c_str());
+	for (const auto& arg : argList)
+		printf("Arg: %.*s\n", (int)arg.size(), arg.data());
 
-	p.replacements.emplace_back(start, p.curr, "");
+	p.emit(start, "");
 }
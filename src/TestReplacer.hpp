@@ -6,9 +6,11 @@
 //! Replaces \\integral{args} with a properly formatted LaTeX integral
 class TestReplacer final : public Replacer {
 public:
-	TestReplacer();
+	void replace(StringView matchedKey, Parser& p) override;
 
-	void replace(const std::string& matchedKey, Parser& p) override;
+	size_t numKeys() const override { return 1; }
+
+	StringView key(size_t) const override { return "\\test"; }
 
 	bool shouldRecurse() const override { return false; }
 };
@@ -0,0 +1,91 @@
+#include "precomp.hpp"
+
+#include "TriggerScanner.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#define SEMTEX_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define SEMTEX_X86_SIMD 0
+#endif
+
+TriggerScanner::TriggerScanner(StringView triggers)
+	: table(), bytes(), numBytes(0), useAVX2(false)
+{
+	table.fill(false);
+	for (char c : triggers)
+		add(static_cast<unsigned char>(c));
+#if SEMTEX_X86_SIMD
+	__builtin_cpu_init();
+	useAVX2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+const char* TriggerScanner::scan(const char* curr, const char* end) const
+{
+#if SEMTEX_X86_SIMD
+	if (useAVX2)
+		return scanAVX2(curr, end);
+	return scanSSE2(curr, end);
+#else
+	return scanScalar(curr, end);
+#endif
+}
+
+const char* TriggerScanner::scanScalar(const char* curr, const char* end) const
+{
+	while (curr < end && !isTrigger(*curr))
+		++curr;
+	return curr;
+}
+
+#if SEMTEX_X86_SIMD
+
+const char* TriggerScanner::scanSSE2(const char* curr, const char* end) const
+{
+	// Compare each 16-byte block against every trigger byte and OR the results together.
+	// The trigger set is small (a dozen or so bytes), so this beats a per-byte table lookup.
+	while (end - curr >= 16) {
+		const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(curr));
+		__m128i hits = _mm_setzero_si128();
+		for (size_t i = 0; i < numBytes; ++i)
+			hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, _mm_set1_epi8(static_cast<char>(bytes[i]))));
+
+		const unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(hits));
+		if (mask != 0)
+			return curr + __builtin_ctz(mask);
+		curr += 16;
+	}
+	return scanScalar(curr, end);
+}
+
+__attribute__((target("avx2")))
+const char* TriggerScanner::scanAVX2(const char* curr, const char* end) const
+{
+	while (end - curr >= 32) {
+		const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(curr));
+		__m256i hits = _mm256_setzero_si256();
+		for (size_t i = 0; i < numBytes; ++i)
+			hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, _mm256_set1_epi8(static_cast<char>(bytes[i]))));
+
+		const unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(hits));
+		if (mask != 0)
+			return curr + __builtin_ctz(mask);
+		curr += 32;
+	}
+	return scanSSE2(curr, end);
+}
+
+#else
+
+const char* TriggerScanner::scanSSE2(const char* curr, const char* end) const
+{
+	return scanScalar(curr, end);
+}
+
+const char* TriggerScanner::scanAVX2(const char* curr, const char* end) const
+{
+	return scanScalar(curr, end);
+}
+
+#endif
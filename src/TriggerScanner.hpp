@@ -0,0 +1,55 @@
+#ifndef __TRIGGER_SCANNER_HPP__
+#define __TRIGGER_SCANNER_HPP__
+
+#include "StringView.hpp"
+
+/*!
+ * \brief Finds the next byte in a buffer that belongs to a small set of "trigger" bytes
+ *
+ * Used by the parser to jump over text that cannot start a key, comment, include, or newline.
+ * The search is vectorized (SSE2, or AVX2 when the CPU supports it) where available,
+ * with a table-driven fallback everywhere else.
+ */
+class TriggerScanner {
+public:
+	//! Constructor
+	//! \param triggers The bytes to stop on
+	TriggerScanner(StringView triggers);
+
+	//! Adds a byte to stop on
+	void add(unsigned char b)
+	{
+		if (!table[b]) {
+			table[b] = true;
+			bytes[numBytes++] = b;
+		}
+	}
+
+	//! Returns true if the byte is one we stop on
+	bool isTrigger(char c) const { return table[static_cast<unsigned char>(c)]; }
+
+	/*!
+	 * \brief Finds the first trigger byte in [curr, end)
+	 * \returns The location of the trigger byte, or end if there is none
+	 */
+	const char* next(const char* curr, const char* end) const
+	{
+		// Most calls land right on a trigger (we just failed to match a key there, etc.)
+		if (curr < end && isTrigger(*curr))
+			return curr;
+		return scan(curr, end);
+	}
+
+private:
+	std::array<bool, 256> table; //!< table[b] is true if b is a trigger byte
+	std::array<unsigned char, 256> bytes; //!< The distinct trigger bytes, for building vector comparisons
+	size_t numBytes; //!< How many of bytes are in use
+	bool useAVX2; //!< True if the CPU supports AVX2 and we were built with x86 intrinsics
+
+	const char* scan(const char* curr, const char* end) const;
+	const char* scanScalar(const char* curr, const char* end) const;
+	const char* scanSSE2(const char* curr, const char* end) const;
+	const char* scanAVX2(const char* curr, const char* end) const;
+};
+
+#endif
@@ -5,17 +5,13 @@
 #include "Exceptions.hpp"
 #include "FileParser.hpp"
 
-UnitReplacer::UnitReplacer()
-	: Replacer({"\\unit"})
-{ }
-
-void UnitReplacer::replace(const std::string& matchedKey, Parser& p)
+void UnitReplacer::replace(StringView matchedKey, Parser& p)
 {
 	const char* start = p.curr;
 	p.curr += matchedKey.length();
 
-	std::unique_ptr<MacroOptions> options;
-	decltype(p.parseBracketArgs()) argList;
+	MacroOptions options;
+	ArgList argList;
 	try {
 		options = p.parseMacroOptions();
 		argList = p.parseBracketArgs();
@@ -24,14 +20,19 @@ void UnitReplacer::replace(const std::string& matchedKey, Parser& p)
 		throw Exceptions::InvalidInputException(ex.message + " in \\unit", __FUNCTION__);
 	}
 
-	if (options->opts.size() != 0)
+	if (options.opts.size() != 0)
 		p.errorOnLine(matchedKey + " does not take options");
 
-	if (options->flags.size() != 0)
+	if (options.flags.size() != 0)
 		p.errorOnLine(matchedKey + " does not take flags");
 
-	if (argList->size() != 1)
+	if (argList.size() != 1)
 		p.errorOnLine("Incorrect argument(s) for \\unit, which takes a single argument");
 
-	p.replacements.emplace_back(start, p.curr, "\\,\\mathrm{" + argList->at(0) + "}");
+	ReplacementText replacement(p);
+	replacement += "\\,\\mathrm{";
+	replacement.splice(argList[0]);
+	replacement += "}";
+
+	p.emit(start, replacement);
 }
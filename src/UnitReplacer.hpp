@@ -6,12 +6,18 @@
 //! Replaces "\unit{foo}" with "\,\mathrm{foo}"
 class UnitReplacer final : public Replacer {
 public:
-	UnitReplacer();
+	void replace(StringView matchedKey, Parser& p) override;
 
-	void replace(const std::string& matchedKey, Parser& p) override;
+	size_t numKeys() const override { return 1; }
+
+	StringView key(size_t) const override { return "\\unit"; }
 
 	// Debatable if we should allow for replacements in units, but allow it for now
 	bool shouldRecurse() const override { return true; }
+
+	bool isPure() const override { return true; }
+
+	unsigned int modes() const override { return Math; }
 };
 
 #endif
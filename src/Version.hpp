@@ -0,0 +1,7 @@
+#ifndef __VERSION_HPP__
+#define __VERSION_HPP__
+
+//! SemTeX's version. Anything cached by a different version is thrown away (see BuildCache).
+#define SEMTEX_VERSION "alpha"
+
+#endif
@@ -0,0 +1,89 @@
+#include "precomp.hpp"
+
+#include "Watcher.hpp"
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "Exceptions.hpp"
+#include "IncludeGraph.hpp"
+
+namespace {
+	//! Events that mean a file in a watched directory now has new contents.
+	//! Writers close the file when they're done, and atomic saves rename a new file over the old one.
+	const uint32_t kChangeEvents = IN_CLOSE_WRITE | IN_MOVED_TO;
+}
+
+Watcher::Watcher()
+	: fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)), dirs(), files()
+{
+	if (fd < 0)
+		throw Exceptions::FileException("Error: Could not start watching files (inotify is unavailable)", __FUNCTION__);
+}
+
+Watcher::~Watcher()
+{
+	close(fd);
+}
+
+void Watcher::watch(const std::string& file)
+{
+	boost::filesystem::path dir = boost::filesystem::path(file).parent_path();
+	if (dir.empty())
+		dir = ".";
+	const std::string canonicalDir = IncludeGraph::canonicalPath(dir.string());
+	const std::string canonicalFile = canonicalDir + "/" + boost::filesystem::path(file).filename().string();
+	if (!files.emplace(canonicalFile, file).second)
+		return;
+
+	// inotify hands back the same descriptor for a directory we are already watching
+	const int wd = inotify_add_watch(fd, canonicalDir.c_str(), kChangeEvents);
+	if (wd < 0)
+		throw Exceptions::FileException("Error: Could not watch " + canonicalDir + " for changes", __FUNCTION__);
+	dirs[wd] = canonicalDir;
+}
+
+std::vector<Watcher::Change> Watcher::waitForChanges(std::chrono::milliseconds settleTime)
+{
+	std::vector<Change> changes;
+	while (changes.empty())
+		readEvents(-1, changes);
+	while (readEvents(static_cast<int>(settleTime.count()), changes))
+		;
+	return changes;
+}
+
+bool Watcher::readEvents(int timeout, std::vector<Change>& changes)
+{
+	struct pollfd p = {fd, POLLIN, 0};
+	const int ready = poll(&p, 1, timeout);
+	if (ready < 0 && errno != EINTR)
+		throw Exceptions::FileException("Error: Could not wait for files to change", __FUNCTION__);
+	if (ready <= 0)
+		return false;
+
+	const auto now = std::chrono::steady_clock::now();
+	alignas(struct inotify_event) char buff[4096];
+	ssize_t got;
+	while ((got = read(fd, buff, sizeof(buff))) > 0) {
+		for (const char* at = buff; at < buff + got; ) {
+			const auto* ev = reinterpret_cast<const struct inotify_event*>(at);
+			at += sizeof(struct inotify_event) + ev->len;
+
+			const auto dir = dirs.find(ev->wd);
+			if (ev->len == 0 || dir == dirs.end())
+				continue;
+			const auto watched = files.find(dir->second + "/" + ev->name);
+			if (watched == files.end())
+				continue;
+
+			const std::string& name = watched->second;
+			if (std::none_of(changes.begin(), changes.end(), [&](const Change& c) { return c.file == name; }))
+				changes.push_back({name, now});
+		}
+	}
+	if (got < 0 && errno != EAGAIN && errno != EINTR)
+		throw Exceptions::FileException("Error: Could not read file changes", __FUNCTION__);
+	return true;
+}
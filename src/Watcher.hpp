@@ -0,0 +1,60 @@
+#ifndef __WATCHER_HPP__
+#define __WATCHER_HPP__
+
+/*!
+ * \brief Waits for files to change, using inotify
+ *
+ * Editors often save by writing a new file and renaming it over the old one,
+ * which a watch on the file itself would lose track of. So we watch the directories
+ * the files are in and pick out events for the files we care about by name.
+ */
+class Watcher {
+public:
+	//! What a file is called by whoever asked us to watch it, and when it changed
+	struct Change {
+		std::string file;
+		std::chrono::steady_clock::time_point when;
+	};
+
+	/*!
+	 * \brief Constructor
+	 * \throws FileException if inotify isn't available
+	 */
+	Watcher();
+
+	~Watcher();
+
+	/*!
+	 * \brief Starts watching a file. Does nothing if we already are.
+	 * \throws FileException if its directory can't be watched
+	 */
+	void watch(const std::string& file);
+
+	/*!
+	 * \brief Waits until at least one watched file changes, then for things to settle down
+	 *
+	 * Saving often changes several files in quick succession (or one file several times),
+	 * so we keep collecting changes until there have been none for settleTime.
+	 * \returns The files that changed (each once), in the order they first changed
+	 * \throws FileException if reading events fails
+	 */
+	std::vector<Change> waitForChanges(std::chrono::milliseconds settleTime);
+
+	// No copy or assignment
+	Watcher(const Watcher&) = delete;
+	Watcher& operator=(const Watcher&) = delete;
+
+private:
+	int fd; //!< The inotify instance
+	std::unordered_map<int, std::string> dirs; //!< Canonical path of each watched directory, by watch descriptor
+	std::unordered_map<std::string, std::string> files; //!< Given name of each watched file, by canonical path
+
+	/*!
+	 * \brief Reads whatever events are waiting, adding changes to watched files to changes
+	 * \param timeout How long to wait for an event (in ms), or -1 to wait forever
+	 * \returns false if the timeout expired before any event came
+	 */
+	bool readEvents(int timeout, std::vector<Change>& changes);
+};
+
+#endif
@@ -0,0 +1,297 @@
+#include "precomp.hpp"
+
+#include "WorkerPool.hpp"
+
+#include <climits>
+#include <sched.h>
+
+#include "Jobserver.hpp"
+
+namespace {
+	//! The pool the current thread works for, if any, and the index of its deque
+	thread_local const WorkerPool* currentPool = nullptr;
+	thread_local size_t currentIndex = 0;
+}
+
+WorkerPool::WorkerPool(StartCallback call, unsigned int workers)
+	: cb(call), numWorkers(0), jobserver(nullptr), deques(), threads(), threadsStarted(false), outstanding(0),
+	  queued(0), sleepers(0), sleepMutex(), wake(), stopping(false)
+{
+	setNumWorkers(workers);
+}
+
+WorkerPool::~WorkerPool()
+{
+	stop();
+}
+
+namespace {
+	//! Reads the first line of a file, returning false if it couldn't be read
+	bool readLine(const std::string& path, std::string& line)
+	{
+		std::ifstream in(path);
+		return static_cast<bool>(std::getline(in, line));
+	}
+
+	//! Turns a CPU quota into a number of CPUs, rounding up. A quota of zero or less means no limit.
+	unsigned int quotaCpus(long long quota, long long period)
+	{
+		if (quota <= 0 || period <= 0)
+			return UINT_MAX;
+		return static_cast<unsigned int>(std::min<long long>((quota + period - 1) / period, UINT_MAX));
+	}
+
+	/*!
+	 * \brief Returns the number of CPUs our cgroup's CPU quota allows us, or UINT_MAX if there isn't one
+	 *
+	 * For cgroup v2, every cgroup from ours up to the root can have a quota (in cpu.max), and the tightest wins.
+	 * For v1, the quota lives in the cpu controller's cpu.cfs_quota_us and cpu.cfs_period_us.
+	 * Containers often mount their own cgroup as the root, so the root directory is checked too.
+	 */
+	unsigned int cgroupCpus()
+	{
+		unsigned int ret = UINT_MAX;
+
+		std::ifstream cgroups("/proc/self/cgroup");
+		std::string line;
+		while (std::getline(cgroups, line)) {
+			// Each line is hierarchy-ID:controller-list:path
+			const size_t firstColon = line.find(':');
+			const size_t secondColon = line.find(':', firstColon + 1);
+			if (firstColon == std::string::npos || secondColon == std::string::npos)
+				continue;
+			const std::string controllers = line.substr(firstColon + 1, secondColon - firstColon - 1);
+			std::string path = line.substr(secondColon + 1);
+
+			if (controllers.empty()) {
+				// cgroup v2
+				while (true) {
+					std::string max;
+					if (readLine("/sys/fs/cgroup" + path + "/cpu.max", max) && max.compare(0, 3, "max") != 0) {
+						long long quota = 0, period = 0;
+						if (sscanf(max.c_str(), "%lld %lld", &quota, &period) == 2)
+							ret = std::min(ret, quotaCpus(quota, period));
+					}
+					if (path.empty() || path == "/")
+						break;
+					path.erase(path.rfind('/'));
+				}
+			}
+			else {
+				// cgroup v1. Only the cpu controller has a quota.
+				std::vector<std::string> names;
+				boost::split(names, controllers, boost::is_any_of(","));
+				if (std::find(names.begin(), names.end(), "cpu") == names.end())
+					continue;
+
+				for (const std::string& dir : {"/sys/fs/cgroup/" + controllers + path, "/sys/fs/cgroup/cpu" + path,
+				                               "/sys/fs/cgroup/" + controllers, std::string("/sys/fs/cgroup/cpu")}) {
+					std::string quota, period;
+					if (readLine(dir + "/cpu.cfs_quota_us", quota) && readLine(dir + "/cpu.cfs_period_us", period)) {
+						ret = std::min(ret, quotaCpus(atoll(quota.c_str()), atoll(period.c_str())));
+						break;
+					}
+				}
+			}
+		}
+		return ret;
+	}
+}
+
+unsigned int WorkerPool::availableCpus()
+{
+	unsigned int cpus = std::thread::hardware_concurrency();
+#ifdef __linux__
+	cpu_set_t set;
+	if (sched_getaffinity(0, sizeof(set), &set) == 0)
+		cpus = CPU_COUNT(&set);
+	cpus = std::min(cpus, cgroupCpus());
+#endif
+	return std::max(1u, cpus);
+}
+
+void WorkerPool::setNumWorkers(unsigned int workers)
+{
+	if (outstanding > 0 || threadsStarted)
+		return;
+
+	numWorkers = std::max(1u, workers);
+	deques.clear();
+	for (unsigned int n = 0; n < numWorkers; ++n)
+		deques.emplace_back(new Deque);
+}
+
+size_t WorkerPool::currentWorker() const
+{
+	return currentPool == this ? currentIndex : 0;
+}
+
+void WorkerPool::submit(Task&& task)
+{
+	// Start our threads once there is more than one thing to do at a time
+	if (outstanding++ > 0 && numWorkers > 1 && !threadsStarted.exchange(true)) {
+		if (cb != nullptr)
+			cb(numWorkers - 1);
+		for (unsigned int n = 1; n < numWorkers; ++n)
+			threads.emplace_back(&WorkerPool::threadProc, this, n);
+	}
+
+	// Count the task before it can be taken, so that queued never dips below zero.
+	// Anyone woken before it is pushed just goes around again.
+	++queued;
+	Deque& d = *deques[currentWorker()];
+	{
+		std::lock_guard<std::mutex> lock(d.m);
+		d.tasks.push_back(std::move(task));
+	}
+
+	// A sleeper either sees queued go up before it waits, or is waiting by the time we notify.
+	if (sleepers > 0) {
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		wake.notify_one();
+	}
+}
+
+void WorkerPool::run()
+{
+	const size_t self = currentWorker();
+	while (outstanding > 0) {
+		if (!runOne(self))
+			sleepUntil([this] { return outstanding == 0 || queued > 0; });
+	}
+}
+
+void WorkerPool::runAll(std::vector<Task>&& tasks)
+{
+	std::atomic<size_t> remaining(tasks.size());
+	for (Task& t : tasks) {
+		// C++11 lambdas can't capture by move, so t is copied into the wrapper
+		submit([this, &remaining, t] {
+			t();
+			if (--remaining == 0) {
+				std::lock_guard<std::mutex> lock(sleepMutex);
+				wake.notify_all();
+			}
+		});
+	}
+
+	// Our own deque is checked first, and the batch is at the back of it, so we work on it before anything else
+	const size_t self = currentWorker();
+	while (remaining > 0) {
+		if (!runOne(self))
+			sleepUntil([&remaining, this] { return remaining == 0 || queued > 0; });
+	}
+}
+
+void WorkerPool::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+		wake.notify_all();
+	}
+	// Wake up anyone still waiting on a token
+	if (jobserver != nullptr && !threads.empty())
+		jobserver->cancel();
+	for (auto& t : threads)
+		t.join();
+	threads.clear();
+}
+
+bool WorkerPool::runOne(size_t self)
+{
+	Task task;
+	{
+		Deque& own = *deques[self];
+		std::lock_guard<std::mutex> lock(own.m);
+		if (!own.tasks.empty()) {
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+		}
+	}
+	for (size_t n = 1; !task && n < numWorkers; ++n) {
+		Deque& victim = *deques[(self + n) % numWorkers];
+		std::lock_guard<std::mutex> lock(victim.m);
+		if (!victim.tasks.empty()) {
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+		}
+	}
+	if (!task)
+		return false;
+
+	--queued;
+	try {
+		task();
+	}
+	catch (...) {
+		finished();
+		throw;
+	}
+	finished();
+	return true;
+}
+
+void WorkerPool::finished()
+{
+	if (--outstanding == 0) {
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		wake.notify_all();
+	}
+}
+
+template <typename Pred>
+void WorkerPool::sleepUntil(Pred pred)
+{
+	// Sleeping with nothing outstanding is just being idle, not waiting for work
+	const bool waiting = outstanding > 0;
+	const auto start = waiting ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+	{
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		++sleepers;
+		wake.wait(lock, pred);
+		--sleepers;
+	}
+	if (waiting)
+		addWait(std::chrono::steady_clock::now() - start);
+}
+
+void WorkerPool::addWait(std::chrono::steady_clock::duration d)
+{
+	deques[currentWorker()]->waitNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+std::vector<double> WorkerPool::waitSeconds() const
+{
+	std::vector<double> ret;
+	for (const auto& d : deques)
+		ret.push_back(d->waitNanos / 1e9);
+	return ret;
+}
+
+void WorkerPool::threadProc(size_t self)
+{
+	currentPool = this;
+	currentIndex = self;
+	while (true) {
+		if (queued > 0) {
+			// Hold a token for as long as there is work to do.
+			// If we can't get one, leave the work to the rest of the pool (and whoever called run()).
+			if (jobserver != nullptr) {
+				const auto start = std::chrono::steady_clock::now();
+				const bool acquired = jobserver->acquire();
+				addWait(std::chrono::steady_clock::now() - start);
+				if (!acquired)
+					break;
+			}
+			while (runOne(self)) { }
+			if (jobserver != nullptr)
+				jobserver->release();
+		}
+
+		bool stop = false;
+		sleepUntil([this, &stop] { return (stop = stopping) || queued > 0; });
+		if (stop)
+			break;
+	}
+}
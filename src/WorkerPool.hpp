@@ -0,0 +1,129 @@
+#ifndef __WORKER_POOL_HPP__
+#define __WORKER_POOL_HPP__
+
+class Jobserver;
+
+/*!
+ * \brief A work-stealing thread pool
+ *
+ * Each worker has its own deque of tasks. Tasks submitted from a worker go on its own deque,
+ * which it works through newest first. Workers that run out of tasks steal the oldest ones
+ * from the others, and sleep only when there is nothing left to steal.
+ *
+ * The pool keeps count of the tasks that have been submitted but not finished,
+ * so run() returns the moment the last one finishes instead of polling for it.
+ * Whoever calls run() works on tasks too, so the pool only needs numWorkers - 1 threads of its own.
+ * Those are only started once a second task is submitted while the first is still outstanding.
+ *
+ * If a Jobserver is set, each of the pool's threads holds a token from it while it works,
+ * and the thread calling run() uses the token every process is given for free.
+ */
+class WorkerPool {
+public:
+	//! A unit of work. Tasks may submit more tasks, but shouldn't throw.
+	typedef std::function<void()> Task;
+
+	//! Callback issued just before the pool starts its threads (with the number being started)
+	typedef void (*StartCallback)(unsigned int numThreads);
+
+	/*!
+	 * \brief Constructor
+	 * \param call A callback to issue when the pool starts up its threads, or nullptr
+	 * \param numWorkers The number of threads that work on tasks, counting the one that calls run()
+	 */
+	WorkerPool(StartCallback call, unsigned int numWorkers);
+
+	//! Calls stop()
+	~WorkerPool();
+
+	/*!
+	 * \brief Returns the number of CPUs we can actually use
+	 *
+	 * This is the number of CPUs in our affinity mask, further limited by any CPU quota
+	 * set on our cgroup (v1 or v2), and is at least 1.
+	 */
+	static unsigned int availableCpus();
+
+	//! Changes the number of workers (see the constructor). Has no effect once any tasks have been submitted.
+	void setNumWorkers(unsigned int workers);
+
+	unsigned int getNumWorkers() const { return numWorkers; }
+
+	//! Sets the jobserver the pool's threads take tokens from, or nullptr for none.
+	//! It has to outlive the pool's threads (see stop()).
+	void setJobserver(Jobserver* js) { jobserver = js; }
+
+	//! Adds a task to be run. Can be called from any thread, including from within tasks.
+	void submit(Task&& task);
+
+	//! Works on tasks until every submitted task (including ones they submit) has finished
+	void run();
+
+	/*!
+	 * \brief Runs a batch of tasks in parallel, returning once they have all finished
+	 *
+	 * Can be called from within a task. The calling thread works on the batch (and anything else
+	 * queued) while it waits, so this never ties up a worker.
+	 */
+	void runAll(std::vector<Task>&& tasks);
+
+	//! Stops and joins the pool's threads. Should only be called once there are no tasks left.
+	void stop();
+
+	/*!
+	 * \brief Returns how long each worker has spent waiting for work (or a jobserver token) so far
+	 *
+	 * Only waits that start while tasks are outstanding count, so time spent idle between
+	 * calls to run() doesn't. Worker 0 is whoever calls run().
+	 */
+	std::vector<double> waitSeconds() const;
+
+	// No copy or assignment
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+private:
+	//! A worker's tasks. The owner pushes and pops at the back, and thieves take from the front.
+	struct Deque {
+		std::mutex m;
+		std::deque<Task> tasks;
+		std::atomic<uint64_t> waitNanos; //!< See waitSeconds()
+
+		Deque() : m(), tasks(), waitNanos(0) { }
+	};
+
+	StartCallback cb;
+	unsigned int numWorkers;
+	Jobserver* jobserver;
+	//! One per worker. deques[0] belongs to whatever thread calls run() (and to anyone else outside the pool).
+	std::vector<std::unique_ptr<Deque>> deques;
+	std::vector<std::thread> threads;
+	std::atomic_bool threadsStarted;
+	std::atomic<size_t> outstanding; //!< Tasks submitted but not yet finished
+	std::atomic<size_t> queued; //!< Tasks submitted but not yet started
+	std::atomic<unsigned int> sleepers; //!< Threads waiting on wake (so submit() can skip notifying)
+	std::mutex sleepMutex; //!< Guards sleeping on wake, and stopping
+	std::condition_variable wake; //!< Signalled when a task is queued, when the last task finishes, and on stop()
+	bool stopping;
+
+	//! The index of the calling thread's deque
+	size_t currentWorker() const;
+
+	//! Runs one task, taken from our own deque if possible or stolen from another.
+	//! Returns false if there was nothing to run.
+	bool runOne(size_t self);
+
+	//! Marks a task as finished, waking whoever is waiting in run() if it was the last one
+	void finished();
+
+	//! Waits on wake until pred is true
+	template <typename Pred>
+	void sleepUntil(Pred pred);
+
+	//! Adds to the time the calling thread has spent waiting (see waitSeconds())
+	void addWait(std::chrono::steady_clock::duration d);
+
+	void threadProc(size_t self);
+};
+
+#endif
@@ -1,35 +1,220 @@
 #include "precomp.hpp"
 
+#include <linux/magic.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#include "BuildCache.hpp"
 #include "Context.hpp"
 #include "Exceptions.hpp"
+#include "ExpansionCache.hpp"
 #include "FileParser.hpp"
-#include "FileQueue.hpp"
-#include "ProcessorThread.hpp"
+#include "InputFile.hpp"
+#include "Jobserver.hpp"
+#include "LatexDriver.hpp"
+#include "OutputWriter.hpp"
+#include "Stats.hpp"
+#include "TableReplacer.hpp"
+#include "Version.hpp"
+#include "Watcher.hpp"
 
 // Prototype for the function below so we can declare ctxt with the other static variables.
 // Slightly kludgy, I know.
-void queueCallback(const FileQueue&);
+void poolStartCallback(unsigned int numThreads);
 
 namespace { // Ensure these variables are accessible only within this file.
-	bool threadsStarted = false;
-	std::vector<std::unique_ptr<ProcessorThread>> auxThreads;
-	Context ctxt(&queueCallback);
+	Context ctxt(&poolStartCallback);
 }
 
-void queueCallback(const FileQueue&)
+void poolStartCallback(unsigned int numThreads)
 {
-	if (threadsStarted)
-		return;
-
-	unsigned int numThreads = std::max(2u, std::thread::hardware_concurrency());
-
 	if (ctxt.verbose)
 		printf("Processing multiple files. Starting up %u additional threads.\n", numThreads);
+}
+
+namespace {
+	//! How long to wait after a file changes for more changes before rebuilding (see --watch)
+	const std::chrono::milliseconds kSettleTime(100);
+
+	//! True to copy the PDF (or DVI) LaTeX makes out of the output directory (see --in-memory)
+	bool copyResultOut = false;
 
-	for (unsigned int n = 0; n < numThreads; ++n)
-		auxThreads.emplace_back(new ProcessorThread(ctxt));
+	//! How to report stats, if ctxt.stats is set (see --stats)
+	Stats::Format statsFormat = Stats::Format::Text;
+
+	/*!
+	 * \brief Finds (or makes) a directory in memory for building a file
+	 *
+	 * It's in /dev/shm (or $XDG_RUNTIME_DIR), as long as that is a tmpfs,
+	 * and is named after the file so that the next build of it finds what the last one left behind.
+	 * \throws FileException if there's nowhere suitable
+	 */
+	std::string memoryBackedDir(const std::string& file)
+	{
+		const char* runtimeDir = getenv("XDG_RUNTIME_DIR");
+		const std::array<const char*, 2> candidates = {{"/dev/shm", runtimeDir}};
+
+		char name[64];
+		snprintf(name, sizeof(name), "semtex-%u-%016llx", static_cast<unsigned int>(getuid()),
+		         static_cast<unsigned long long>(hashBytes(boost::filesystem::absolute(file).string().c_str(),
+		                                                   boost::filesystem::absolute(file).string().size())));
+		for (const char* c : candidates) {
+			struct statfs fs;
+			if (c == nullptr || statfs(c, &fs) != 0 || fs.f_type != TMPFS_MAGIC)
+				continue;
+
+			// /dev/shm is shared, so make sure nobody else made the directory first
+			const std::string dir = std::string(c) + "/" + name;
+			struct stat st;
+			if ((mkdir(dir.c_str(), 0700) == 0 || errno == EEXIST)
+			    && lstat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == getuid())
+				return dir;
+		}
+		throw Exceptions::FileException("Error: Could not find a memory-backed (tmpfs) directory to build in",
+		                                __FUNCTION__);
+	}
+
+	/*!
+	 * \brief Builds the LaTeX file generated from file, unless processing failed
+	 * \returns false if LaTeX (or something it needed) failed
+	 */
+	bool runLatex(LatexDriver& latex, const std::string& file)
+	{
+		if (ctxt.error) {
+			if (ctxt.verbose)
+				printf("Skipping LaTeX due to errors\n");
+			return true; // Processing already said what went wrong
+		}
+
+		const std::string texname = outputName(file, ctxt);
+		const auto start = std::chrono::steady_clock::now();
+		try {
+			const bool built = latex.build(texname);
+			if (ctxt.stats != nullptr)
+				ctxt.stats->addLatexTime(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+			if (!built)
+				return false;
+
+			if (copyResultOut) {
+				// LaTeX wrote it next to texname. Put it where it would have written it by default.
+				namespace fs = boost::filesystem;
+				const fs::path built = fs::path(texname).replace_extension();
+				for (const char* ext : {".pdf", ".dvi"}) {
+					const fs::path result = fs::path(built).replace_extension(ext);
+					if (fs::exists(result)) {
+						const InputFile from(result.string());
+						const OutputFile to(result.filename().string());
+						copyFileContents(from, to);
+						break;
+					}
+				}
+			}
+			return true;
+		}
+		catch (const Exceptions::Exception& ex) {
+			fprintf(stderr, "%s\n", ex.message.c_str());
+			return false;
+		}
+	}
+
+	//! Saves the build cache, if there is one
+	void saveCache(const BuildCache* cache)
+	{
+		if (cache == nullptr)
+			return;
 
-	threadsStarted = true;
+		try {
+			cache->save();
+		}
+		catch (const Exceptions::Exception& ex) {
+			// Next run just won't skip as much
+			fprintf(stderr, "%s\n", ex.message.c_str());
+		}
+	}
+
+	//! Prints how often expansions were found in ctxt.expansions, if we're being verbose
+	void reportExpansions()
+	{
+		if (!ctxt.verbose || ctxt.expansions == nullptr)
+			return;
+
+		const size_t hits = ctxt.expansions->hits();
+		const size_t lookups = hits + ctxt.expansions->misses();
+		printf("Expansion cache: %zu of %zu lookups hit (%.1f%%)\n", hits, lookups,
+		       lookups == 0 ? 0.0 : 100.0 * hits / lookups);
+	}
+
+	//! Reports stats for everything done since they were last reported, if they're being collected
+	void reportStats()
+	{
+		if (ctxt.stats == nullptr)
+			return;
+
+		ctxt.stats->setWorkerWaits(ctxt.pool.waitSeconds());
+		ctxt.stats->print(stdout, statsFormat);
+		fflush(stdout);
+		ctxt.stats->clear();
+	}
+
+	/*!
+	 * \brief Watches every file in the include graph, reprocessing files as they change
+	 *        and rerunning LaTeX after each batch of changes. Runs until we are killed.
+	 * \param root The file SemTeX was run on, which has already been processed once
+	 * \param latex What builds the LaTeX file, or nullptr to just process files
+	 */
+	void watchForChanges(const std::string& root, LatexDriver* latex, const BuildCache* cache)
+	{
+		try {
+			Watcher watcher;
+			for (;;) {
+				// Processing may have found new includes
+				const std::vector<std::string> files = ctxt.includes.files();
+				for (const std::string& f : files)
+					watcher.watch(f);
+
+				if (ctxt.verbose)
+					printf("Watching %zu files for changes...\n", files.size());
+				fflush(stdout);
+
+				const std::vector<Watcher::Change> changes = watcher.waitForChanges(kSettleTime);
+				const auto settled = std::chrono::steady_clock::now();
+
+				// Only the files that changed are processed again, along with any includes they add.
+				ctxt.error = false;
+				ctxt.generatedFilesMutex.lock();
+				ctxt.generatedFiles.clear(); // We keep them all anyway
+				ctxt.generatedFilesMutex.unlock();
+				for (const Watcher::Change& c : changes) {
+					if (ctxt.verbose)
+						printf("%s changed\n", c.file.c_str());
+					ctxt.includes.removeIncludes(c.file);
+					enqueueFile(c.file, ctxt);
+				}
+				ctxt.pool.run();
+				saveCache(cache);
+
+				if (latex != nullptr)
+					runLatex(*latex, root);
+				reportExpansions();
+				reportStats();
+
+				if (ctxt.verbose) {
+					using std::chrono::duration_cast;
+					using std::chrono::milliseconds;
+					const auto first = changes.front().when;
+					printf("Rebuilt %zu changed file(s) %lld ms after the first change "
+					       "(%lld ms of that waiting for changes to settle)\n", changes.size(),
+					       static_cast<long long>(duration_cast<milliseconds>(std::chrono::steady_clock::now() - first).count()),
+					       static_cast<long long>(duration_cast<milliseconds>(settled - first).count()));
+				}
+			}
+		}
+		catch (const Exceptions::Exception& ex) {
+			fprintf(stderr, "%s\n", ex.message.c_str());
+			exit(1);
+		}
+	}
 }
 
 int main(int argc, char** argv) {
@@ -41,13 +226,71 @@ int main(int argc, char** argv) {
 	                             "Just process files and output LaTeX ones instead of running LaTeX. Implies -k");
 	TCLAP::ValueArg<std::string> programArg("p", "program", "The LaTeX program to use. Defaults to pdflatex",
 	                                        false, "pdflatex", "LaTeX program");
-	TCLAP::UnlabeledValueArg<std::string> fileArg("file", "Base SemTeX file", true, "",  "file");
+	TCLAP::ValueArg<std::string> outDirArg("o", "output-dir", "Write generated LaTeX files, and everything LaTeX "
+	                                       "writes, to this directory instead of next to the sources. Implies -k",
+	                                       false, "", "directory");
+	TCLAP::SwitchArg memoryFlag("m", "in-memory",
+	                            "Like --output-dir, but in a memory-backed (tmpfs) directory, so intermediate files "
+	                            "never touch the disk. The PDF (or DVI) is copied to the current directory");
+	TCLAP::ValueArg<unsigned int> timeoutArg("t", "latex-timeout", "Stop LaTeX (or BibTeX, Biber or makeindex) "
+	                                         "if it runs for longer than this many seconds, or 0 to never stop it. "
+	                                         "Defaults to 300", false, 300, "seconds");
+	TCLAP::SwitchArg streamFlag("s", "stream",
+	                            "Read files a chunk at a time instead of all at once, so memory use doesn't grow "
+	                            "with file size");
+	TCLAP::SwitchArg graphFlag("G", "print-include-graph",
+	                           "Print which files include which, in Graphviz's dot format, once they are processed");
+	TCLAP::SwitchArg piecesFlag("P", "parallel-parse",
+	                            "Split large files at paragraph breaks and parse the pieces in parallel");
+	// -j matches make
+	TCLAP::ValueArg<unsigned int> jobsArg("j", "jobs", "The number of files to process at once. Defaults to the "
+	                                      "number of CPUs available. When run by make -j, SemTeX also takes job slots "
+	                                      "from make's jobserver", false, 0, "jobs");
+	TCLAP::SwitchArg incrementalFlag("i", "incremental",
+	                                 "Remember what was done with each file (in .semtex-cache, next to the base file or in the "
+	                                 "output directory), and skip files that haven't changed since. LaTeX files whose "
+	                                 "contents haven't changed are left untouched. Implies -k. Ignored with -s");
+	TCLAP::SwitchArg watchFlag("w", "watch",
+	                           "After processing, keep watching every processed file for changes. Reprocess just "
+	                           "the files that change (and any new includes), then rerun LaTeX. Implies -k");
+	TCLAP::ValueArg<std::string> configArg("c", "config", "Load replacement tables from this config file. Defaults to "
+	                                       "semtex.conf next to the base file, if there is one", false, "", "file");
+	TCLAP::MultiArg<std::string> rawEnvArg("", "raw-env", "Copy the contents of this environment through untouched, "
+	                                       "as is always done for verbatim, verbatim*, lstlisting, minted and comment. "
+	                                       "Can be given more than once", false, "environment");
+	TCLAP::SwitchArg cacheFlag("", "cache-expansions",
+	                           "Expand each distinct invocation of a built-in macro once, and copy the result for "
+	                           "every repeat of it. Faster for notes that repeat the same macros a lot, but slower "
+	                           "for deeply nested ones");
+	TCLAP::SwitchArg statsFlag("S", "stats",
+	                           "Report how long reading, parsing, macro recursion and writing took for each file, "
+	                           "how often each macro was replaced and how long it took, how long each thread waited "
+	                           "for work, how long LaTeX took and peak memory use");
+	// TCLAP has no optional values, so this can't be --stats=json
+	TCLAP::ValueArg<std::string> statsFormatArg("", "stats-format", "How to report --stats: text (the default) "
+	                                            "or json. Implies --stats", false, "text", "text|json");
+	TCLAP::UnlabeledValueArg<std::string> fileArg("file", "Base SemTeX file, or - to read SemTeX from stdin and "
+	                                              "write LaTeX to stdout (implies -E)", true, "",  "file");
 
-	TCLAP::CmdLine cmd("SemTeX - Streamlined LaTeX", ' ', "alpha");
+	TCLAP::CmdLine cmd("SemTeX - Streamlined LaTeX", ' ', SEMTEX_VERSION);
 	cmd.add(verbFlag);
 	cmd.add(keepFlag);
 	cmd.add(preOnlyFlag);
 	cmd.add(programArg);
+	cmd.add(outDirArg);
+	cmd.add(memoryFlag);
+	cmd.add(timeoutArg);
+	cmd.add(streamFlag);
+	cmd.add(graphFlag);
+	cmd.add(piecesFlag);
+	cmd.add(jobsArg);
+	cmd.add(incrementalFlag);
+	cmd.add(watchFlag);
+	cmd.add(configArg);
+	cmd.add(rawEnvArg);
+	cmd.add(cacheFlag);
+	cmd.add(statsFlag);
+	cmd.add(statsFormatArg);
 	cmd.add(fileArg);
 
 	cmd.parse(argc, argv);
@@ -58,15 +301,158 @@ int main(int argc, char** argv) {
 		exit(1);
 	}
 
-	const std::string& latexProgram = programArg.getValue();
+	// - reads from stdin and writes to stdout, so there is no file for LaTeX to run on
+	const bool useStdio = fileArg.getValue() == "-";
+	if (useStdio && programArg.isSet()) {
+		fprintf(stderr, "Providing a LaTeX program to run with -p or --program AND\n"
+		        "reading from stdin and writing to stdout with - makes no sense.\n");
+		exit(1);
+	}
+	if (useStdio && watchFlag.getValue()) {
+		fprintf(stderr, "Watching files for changes with -w or --watch AND\n"
+		        "reading from stdin with - makes no sense.\n");
+		exit(1);
+	}
+	if (outDirArg.isSet() && memoryFlag.getValue()) {
+		fprintf(stderr, "Providing an output directory with -o or --output-dir AND\n"
+		        "asking for one in memory with -m or --in-memory makes no sense.\n");
+		exit(1);
+	}
+	if (statsFormatArg.getValue() != "text" && statsFormatArg.getValue() != "json") {
+		fprintf(stderr, "--stats-format must be text or json, not %s.\n", statsFormatArg.getValue().c_str());
+		exit(1);
+	}
+
+	const bool preprocessOnly = preOnlyFlag.getValue() || useStdio;
+	// Skipping files next time relies on their outputs still being around
+	const bool incremental = incrementalFlag.getValue() && !useStdio && !streamFlag.getValue();
+	// Generated files in an output directory are out of the way, and are reused next time
+	const bool separateOutput = (outDirArg.isSet() || memoryFlag.getValue()) && !useStdio;
+	const bool keepTex = keepFlag.getValue() || incremental || watchFlag.getValue() || separateOutput;
+
+	// Our output goes to stdout, so send everything else we print there to stderr instead
+	int outFd = -1;
+	if (useStdio) {
+		outFd = dup(STDOUT_FILENO);
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+	}
+
+	// Only run LaTeX as many times as it takes for its auxiliary files to stop changing
+	std::unique_ptr<LatexDriver> latex;
+	if (!preprocessOnly) {
+		try {
+			latex.reset(new LatexDriver(programArg.getValue(), std::chrono::seconds(timeoutArg.getValue()),
+			                            verbFlag.getValue()));
+		}
+		catch (const Exceptions::Exception& ex) {
+			fprintf(stderr, "%s\n", ex.message.c_str());
+			exit(1);
+		}
+	}
 
 	ctxt.verbose = verbFlag.getValue();
+	ctxt.stream = streamFlag.getValue();
+	ctxt.parallelParse = piecesFlag.getValue();
+	ctxt.rawEnvironments = rawEnvArg.getValue();
+
+	// Repeated macro invocations are expanded once, if asked to
+	ExpansionCache expansions;
+	if (cacheFlag.getValue())
+		ctxt.expansions = &expansions;
+
+	Stats stats;
+	if (statsFlag.getValue() || statsFormatArg.isSet()) {
+		ctxt.stats = &stats;
+		statsFormat = statsFormatArg.getValue() == "json" ? Stats::Format::Json : Stats::Format::Text;
+	}
+
+	if (separateOutput) {
+		try {
+			ctxt.outputDir = memoryFlag.getValue() ? memoryBackedDir(fileArg.getValue()) : outDirArg.getValue();
+			boost::filesystem::create_directories(ctxt.outputDir);
+		}
+		catch (const Exceptions::Exception& ex) {
+			fprintf(stderr, "%s\n", ex.message.c_str());
+			exit(1);
+		}
+		catch (const boost::filesystem::filesystem_error&) {
+			fprintf(stderr, "Error: Could not create output directory %s\n", ctxt.outputDir.c_str());
+			exit(1);
+		}
+		if (latex)
+			latex->setOutputDirectory(ctxt.outputDir);
+		copyResultOut = memoryFlag.getValue();
+	}
 
 	if (ctxt.verbose)
 		printf("Running SemTex - Streamlined LaTeX\n");
 
+	// When make is running us in parallel with other jobs, share its job slots instead of adding our own.
+	// jobserver has to outlive the pool's threads, which are stopped below.
+	Jobserver::Status jobserverStatus;
+	const std::unique_ptr<Jobserver> jobserver = Jobserver::fromEnvironment(jobserverStatus);
+	if (jobsArg.getValue() > 0) {
+		ctxt.pool.setNumWorkers(jobsArg.getValue());
+	}
+	else if (jobserverStatus == Jobserver::Status::Unusable) {
+		// make is running jobs in parallel, but didn't hand us its jobserver,
+		// so the only job slot we know we have is our own.
+		if (ctxt.verbose)
+			printf("make's jobserver is not available (is the rule running SemTeX marked with +?). "
+			       "Processing one file at a time.\n");
+		ctxt.pool.setNumWorkers(1);
+	}
+	ctxt.pool.setJobserver(jobserver.get());
+	if (ctxt.verbose && jobserver)
+		printf("Taking job slots from make's jobserver\n");
+
+	std::unique_ptr<TableReplacer> table;
+	std::unique_ptr<BuildCache> cache;
 	try {
-		processFile(fileArg.getValue(), ctxt);
+		// Keep the compiled tables and the cache with the generated files, so the source tree stays clean
+		const boost::filesystem::path baseDir = useStdio ? boost::filesystem::path()
+		                                                 : boost::filesystem::path(fileArg.getValue()).parent_path();
+		const boost::filesystem::path dir = separateOutput ? boost::filesystem::path(ctxt.outputDir) : baseDir;
+
+		const std::string config = configArg.isSet() ? configArg.getValue() : (baseDir / "semtex.conf").string();
+		if (configArg.isSet() || FileStamp::of(config).exists)
+			table = loadTables(config, (dir / ".semtex-tables").string(), ctxt);
+
+		if (incremental) {
+			// Outputs depend on the tables and raw environments too
+			std::string settings;
+			if (table) {
+				char tables[32];
+				snprintf(tables, sizeof(tables), "tables %016llx", static_cast<unsigned long long>(table->fingerprint()));
+				settings = tables;
+			}
+			for (const std::string& env : ctxt.rawEnvironments)
+				settings += " raw " + env;
+			cache.reset(new BuildCache((dir / ".semtex-cache").string(), settings));
+			ctxt.cache = cache.get();
+		}
+
+		if (useStdio) {
+			InputStream in(STDIN_FILENO, "<stdin>");
+			ctxt.includes.addRoot(in.name());
+			FileStats fs;
+			{
+				PhaseTimer timer(ctxt.stats != nullptr ? &fs : nullptr, FileStats::Parse);
+				processStream(in, outFd, ctxt);
+			}
+			if (ctxt.stats != nullptr)
+				ctxt.stats->addFile(in.name(), fs);
+			close(outFd);
+			// Files it includes were added to the pool as they were found. Work on them until they're all done.
+			ctxt.pool.run();
+		}
+		else {
+			// Included files are added to the pool as they are found.
+			// This thread works on them too, and returns as soon as the last one is finished.
+			ctxt.includes.addRoot(fileArg.getValue());
+			enqueueFile(fileArg.getValue(), ctxt);
+			ctxt.pool.run();
+		}
 	}
 	catch (const Exceptions::Exception& ex) {
 		ctxt.error = true;
@@ -81,49 +467,23 @@ int main(int argc, char** argv) {
 		fprintf(stderr, "Unexpected fatal error");
 	}
 
-	if (threadsStarted) {
-		// Wait for the threads to finish doing their thing
-		// See FileQueue::setDequeueEnabled for an explanation on why we are disabling dequeuing here
-		while (true) {
-			ctxt.queue.setDequeueEnabled(false);
-			bool done = std::none_of(auxThreads.begin(), auxThreads.end(),
-									 [](const std::unique_ptr<ProcessorThread>& pt) { return pt->isBusy(); } );
-			done = done && (ctxt.queue.empty() || ctxt.error);
-			ctxt.queue.setDequeueEnabled(true);
-			if (done)
-				break;
-			std::this_thread::sleep_for(ProcessorThread::dequeueTimeout / 2);
-		}
-
-		for (auto& thread : auxThreads)
-			thread->beginExit();
-	}
-
-	if (!ctxt.error) {
-		if (!preOnlyFlag.getValue()) {
-			if (ctxt.verbose)
-				printf("Running %s...\n", latexProgram.c_str());
+	saveCache(cache.get());
 
-			//! \todo Move this into a function? This is the second place we use it
-			boost::regex fext(R"regex((stex|sex)$)regex", boost::regex::optimize);
-			const std::string texname = boost::regex_replace(fileArg.getValue(), fext, "tex");
+	if (graphFlag.getValue())
+		ctxt.includes.printDot(stdout);
 
-			fflush(stdout); // Make sure everything prints before LaTeX does
+	const bool latexSucceeded = !latex || runLatex(*latex, fileArg.getValue());
+	reportExpansions();
+	reportStats();
 
-			// TODO: handle pdflatex I/O instead of just calling it
-			system((latexProgram + " " + texname).c_str());
+	// Keep the pool's threads around for the next change
+	if (watchFlag.getValue())
+		watchForChanges(fileArg.getValue(), latex.get(), cache.get());
 
-			if (ctxt.verbose)
-				printf("%s exited.\n", latexProgram.c_str());
-		}
-	}
-	else
-	{
-		if (ctxt.verbose)
-			printf("Skipping %s due to errors\n", latexProgram.c_str());
-	}
+	// Everything has been processed, so the pool's threads have nothing left to do
+	ctxt.pool.stop();
 
-	if (!keepFlag.getValue() && !preOnlyFlag.getValue()) {
+	if (!keepTex && !preprocessOnly) {
 		std::lock_guard<std::mutex> genLock(ctxt.generatedFilesMutex);
 		for (const std::string& f : ctxt.generatedFiles) {
 			if (ctxt.verbose)
@@ -133,9 +493,5 @@ int main(int argc, char** argv) {
 		}
 	}
 
-	if (threadsStarted) {
-		for (auto& thread : auxThreads)
-			thread->join();
-	}
-	return 0;
+	return latexSucceeded ? 0 : 1;
 }